@@ -0,0 +1,139 @@
+#!/bin/bash
+# End-to-end scaling benchmark. Runs a matrix of rank counts and
+# configs on H^2^K(8), checks every signature, and stores wall times
+# and per-timer breakdowns in bench/results/<label>.tsv, then compares
+# them against the previous results file. Timings only compare on the
+# same machine, so no results ship with the repo: the first run on a
+# machine becomes its baseline.
+#
+# usage: bench/scaling.sh [-k K] [-m max ranks] [-n repeats] [-l label] [-b binary]
+
+K=22
+MAX_RANKS=8
+REPEATS=1
+LABEL=$(git describe --always --dirty 2>/dev/null || date +%Y%m%d%H%M%S)
+BINARY=testdir/burn_hydra
+while getopts "k:m:n:l:b:" opt; do
+    case $opt in
+    k) K=$OPTARG ;;
+    m) MAX_RANKS=$OPTARG ;;
+    n) REPEATS=$OPTARG ;;
+    l) LABEL=$OPTARG ;;
+    b) BINARY=$OPTARG ;;
+    *) exit 1 ;;
+    esac
+done
+BINARY=$(realpath $BINARY)
+RESULTS=$(dirname $(realpath $0))/results
+mkdir -p $RESULTS
+OUT=$RESULTS/$LABEL.tsv
+PREVIOUS=$(ls -t $RESULTS/*.tsv 2>/dev/null | grep -v "^$OUT$" | head -1)
+
+# H^2^k(8) mod 2^128 and mod 3^128
+declare -A SIGNATURES=(
+    [20]="106200599418418904108526163437042981752 2082215363803043085037300339655341613206610101517858931700771"
+    [21]="44174184758879056251560084315074137848 754513318659183670025600542404057667760878438618993297251679"
+    [22]="111287972020533421917559603670836339608 234388040182294038525882515318029237878230918987697106596034"
+    [23]="41148928623730894852653289251621372206 7530738586461431499587928368608316091151465153071305643927382"
+    [24]="213799570645266810255858283718595812274 3229091089845890281952442224237716775626503880803951525406945"
+    [25]="304818855585694549420565952305497051874 5837108165841738585158448029100420374658141571830406568782566"
+    [26]="31848934250314775156605172273469025153 2246674935863200705435021934434735832940657095564955971137014"
+)
+
+# a ramp from 2^8 up to 2^k over the given number of ranks
+config() {
+    local ranks=$1 k=$2
+    case $ranks in
+    1) echo "8-$k" ;;
+    2) echo "8-16,16-$k" ;;
+    4) echo "8-12,12-16,16-20,20-$k" ;;
+    8) echo "8-10,10-12,12-14,14-16,16-18,18-20,20-$k/$k-$k" ;;
+    16) echo "8-10,10-12,12-14,14-16,16-18,18-20,20-$k/$k-$k" ;;
+    esac
+}
+
+TIMERS=("grinding chain" "grinding basecase" "waiting to recv left" "waiting to recv right")
+
+# prints: wall seconds, ok/FAIL, then the largest time any rank spent on each timer
+run() {
+    local ranks=$1 k=$2 cfg=$3
+    local best=""
+    local status=ok
+    local timers=""
+    for i in $(seq $REPEATS); do
+        local dir=$(mktemp -d)
+        local start=$(date +%s.%N)
+        # every rank's lines, as the launcher forwards them
+        (cd $dir && mpirun -n $ranks -- $BINARY -x 8 -n $((1<<k)) -c $cfg > stdout 2>&1)
+        local stop=$(date +%s.%N)
+        local wall=$(awk "BEGIN { print $stop - $start }")
+        local got=$(grep -aho "H^2^$k(8) ≡ [0-9]* (mod 2^128) ≡ [0-9]* (mod 3^128)" $dir/stdout | awk '{print $3, $7}')
+        if [ "$got" != "${SIGNATURES[$k]}" ]; then
+            status=FAIL
+        fi
+        if [ -z "$best" ] || awk "BEGIN { exit !($wall < $best) }"; then
+            best=$wall
+            timers=""
+            for t in "${TIMERS[@]}"; do
+                timers="$timers	$(grep -a "s spent $t\.$" $dir/stdout | awk 'BEGIN { m = 0 } { if ($1 > m) m = $1 } END { print m }')"
+            done
+        fi
+        rm -rf $dir
+    done
+    echo "$best	$status$timers"
+}
+
+[ -n "${SIGNATURES[$K]}" ] || { echo "No known signature for K=$K."; exit 1; }
+[ $K -ge 20 ] || { echo "K has to be at least 20 for the configs used here."; exit 1; }
+
+header="kind	ranks	k	config	wall	signature"
+for t in "${TIMERS[@]}"; do header="$header	$t"; done
+echo "$header" > $OUT
+
+# strong scaling: the same H^2^K(8) on more and more ranks
+declare -A STRONG
+for ranks in 1 2 4 8 16; do
+    [ $ranks -le $MAX_RANKS ] || continue
+    cfg=$(config $ranks $K)
+    line=$(run $ranks $K $cfg)
+    STRONG[$ranks]=$(echo "$line" | cut -f1)
+    echo "strong	$ranks	$K	$cfg	$line" | tee -a $OUT
+done
+
+# weak scaling: the work grows with about the square of the iterations,
+# so 4 times the ranks get twice the iterations
+declare -A WEAK
+WEAK[1]=${STRONG[1]}
+step=1
+for ranks in 4 16; do
+    k=$((K+step))
+    step=$((step+1))
+    [ $ranks -le $MAX_RANKS ] && [ -n "${SIGNATURES[$k]}" ] || continue
+    cfg=$(config $ranks $k)
+    line=$(run $ranks $k $cfg)
+    WEAK[$ranks]=$(echo "$line" | cut -f1)
+    echo "weak	$ranks	$k	$cfg	$line" | tee -a $OUT
+done
+
+echo
+echo "efficiency	ranks	strong	weak"
+for ranks in 1 2 4 8 16; do
+    [ -n "${STRONG[$ranks]}" ] || continue
+    strong=$(awk "BEGIN { printf \"%.2f\", ${STRONG[1]} / ($ranks * ${STRONG[$ranks]}) }")
+    weak=-
+    [ -n "${WEAK[$ranks]}" ] && weak=$(awk "BEGIN { printf \"%.2f\", ${WEAK[1]} / ${WEAK[$ranks]} }")
+    echo "	$ranks	$strong	$weak"
+done
+
+if [ -z "$PREVIOUS" ]; then
+    echo
+    echo "No earlier results to compare to, $(basename $OUT .tsv) is the baseline from now on."
+else
+    echo
+    echo "compared to $(basename $PREVIOUS .tsv) (wall time ratio, below 1 is faster):"
+    awk -F'\t' 'NR == FNR { if (FNR > 1) old[$1 FS $2 FS $3 FS $4] = $5; next }
+        FNR > 1 { key = $1 FS $2 FS $3 FS $4; if (key in old && old[key] > 0) printf "\t%s\t%s ranks\tk=%s\t%.2f\n", $1, $2, $3, $5 / old[key] }' $PREVIOUS $OUT
+fi
+
+grep -q FAIL $OUT && { echo "Some signatures were wrong."; exit 1; }
+exit 0
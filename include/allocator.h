@@ -0,0 +1,23 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <cstddef>
+
+#include "metrics.h"
+
+// Limb storage for GMP and FLINT. Small arrays come from per-size-class
+// free lists, large ones from their own (huge page) mappings, which can
+// grow without copying.
+void* pool_alloc(size_t);
+void* pool_realloc(void*, size_t);
+void pool_free(void*);
+
+// Has to run before GMP or FLINT allocate anything, since blocks from
+// the default allocator cannot be freed here.
+void allocator_install();
+// Adds the statistics so far to the metrics.
+void allocator_collect(metrics_t*);
+
+void test_allocator();
+
+#endif // ALLOCATOR_H
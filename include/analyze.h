@@ -0,0 +1,42 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+
+// Offline analysis of the rankN.json interval logs.
+
+typedef struct interval {
+    double start;
+    double stop;
+} interval_t;
+
+typedef struct rank_trace {
+    int rank;
+    std::vector<interval_t> intervals[_timer_classes];
+    bool logged[_timer_classes]; // not every rank logs every class
+} rank_trace_t;
+
+typedef struct critical_path {
+    double length;
+    int jumps; // hand-offs between ranks
+    std::vector<double> rank_time; // time each rank spent on the path
+    std::vector<std::vector<double>> class_time; // [rank][timer class]
+} critical_path_t;
+
+typedef struct analyze_config {
+    double min_wait; // shorter waits are not treated as blocking
+    std::vector<std::string> files;
+} analyze_config_t;
+
+void parse_analyze_args(analyze_config_t*, int argc, char** argv);
+bool read_trace(const char* filename, rank_trace_t*);
+critical_path_t find_critical_path(const std::vector<rank_trace_t>&, double min_wait);
+void print_analysis(std::ostream&, const std::vector<rank_trace_t>&, double min_wait);
+
+void test_critical_path();
+
+#endif // ANALYZE_H
@@ -0,0 +1,26 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <cstdint>
+
+#include "segment.h"
+
+// The blocks stay fmpz, since FLINT does all the arithmetic on them,
+// but their limbs are kept at a capacity that only depends on the block
+// size. The kernel swaps the limbs of a block with those of its tmp
+// rather than allocating products, so once both are at capacity, steps
+// no longer reallocate them.
+
+// Bits block i holds at most, in the middle of a step.
+uint64_t block_capacity_bits(const data_t*, int i);
+// Every block and tmp that is large enough to have limbs gets all of
+// its capacity. Small values can't keep limbs in an fmpz, so blocks the
+// integer hasn't reached get theirs once it does.
+void blocks_reserve(data_t*);
+// Built with make CHECK_BLOCKS=1, stops as soon as a block outgrows its
+// capacity.
+void blocks_check(data_t*);
+
+void test_blocks();
+
+#endif // BLOCKS_H
@@ -0,0 +1,24 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <flint/fmpz.h>
+#include <cstdint>
+
+#include "segment.h"
+
+// Every rank writes its blocks with their global bit offsets, so that
+// a checkpoint can be read back under any config and world size.
+// Collective: the files replace the previous checkpoint's once every
+// rank has written its own.
+void write_checkpoint(data_t*, int64_t iterations);
+// Replaces the stored blocks with the checkpoint's and returns its
+// iteration count. Collective: every rank reads all the files, and
+// returns once all of them are done.
+int64_t read_checkpoint(data_t*);
+
+// Adds the bits [start, end) of v*2^offset, shifted down by start, to rop.
+void add_bit_range(fmpz_t rop, const fmpz_t v, uint64_t offset, uint64_t start, uint64_t end);
+
+void test_add_bit_range();
+
+#endif // CHECKPOINT_H
@@ -7,11 +7,13 @@
 // #include <flint/flint.h>
 // #include <flint/fmpz.h>
 #include <vector>
+#include <string>
 #include <cstdint>
 
 typedef struct problem {
     uint64_t initial;
     int64_t iterations;
+    std::vector<uint64_t> batch; // more starting values, burned alongside initial
 } problem_t;
 
 typedef struct config {
@@ -21,6 +23,20 @@ typedef struct config {
     uint64_t global_block_max; // size of largest block in system
     bool prune_bits;
     int64_t checkpoint_interval;
+    bool restart; // from the checkpoint files in the working directory
+    bool pool_allocator;
+    std::string topology; // "", "host" or a latencies file
+    std::string cache_dir; // for precomputed powers, "" to not cache
+    uint64_t carry_interval; // steps between carries going left
+    std::vector<uint64_t> funnel_arity; // per block level below the top, the last one repeats
+    std::string dump_file; // the whole integer at the end of the run, "" for none
+    std::string load_file; // a dump to start from instead of x
+    uint64_t helpers; // ranks past the chain sharing the top segment's products
+    uint64_t help_from; // log size of the smallest power whose products are shared
+    uint64_t segments_per_rank; // consecutive chain segments each rank runs as fibers
+    bool dormant; // segments the integer can't have reached yet sit out their steps
+    bool hardware_counters; // cycles, instructions and cache misses per timer class
+    bool profile_funnel; // time and operand sizes per block and step size
 } config_t;
 
 typedef struct segment {
@@ -2,21 +2,113 @@
 #ifndef COMMUNICATE_H
 #define COMMUNICATE_H
 
+#include <mpi.h>
 #include <gmp.h>
 #include <flint/fmpz.h>
+#include <vector>
 #include "common.h"
 #include "segment.h"
+#include "fibers.h"
 
-void send(metrics_t*, int, int, fmpz_t);
-void recv(metrics_t*, int, int, fmpz_t);
+// Named tags, so that a header can never be mistaken for a payload.
+enum message_tag {
+    tag_payload = 1,
+    tag_header = 2,
+    // between the top segment and its helpers, see helpers.h
+    tag_help_exponent = 3,
+    tag_help_piece = 4,
+    tag_help_product = 5,
+};
 
+// Header flags. Without either, a nonzero payload follows with tag_payload.
+enum carry_flag {
+    carry_in_inbox = 1, // payload was written into the receiver's inbox
+    carry_inline = 2, // payload rides along in the header itself
+};
+
+// Every carry starts with one of these. Zero carries are just the
+// first two words, and carries of up to carry_inline_limbs limbs (the
+// small blocks of the lowest ranks) are folded into the same message.
+// With several lanes, their carries are packed back to back, each
+// padded to the widest, so `limbs` is a multiple of the lane count.
+const uint64_t carry_inline_limbs = 6;
+typedef struct carry_header {
+    uint64_t limbs;
+    uint64_t flags;
+    mp_limb_t inline_limbs[carry_inline_limbs];
+} carry_header_t;
+
+// One neighbor of the chain. Neighbors on the same node exchange
+// carries through inboxes in node-shared windows, so only the header
+// goes through MPI. Neighbors on the same rank hand each other their
+// fmpz's through a queue instead.
+typedef struct link {
+    int rank; // -1 if there is no neighbor on this side
+    int node_rank; // MPI_UNDEFINED unless the neighbor shares our node
+    MPI_Win inbox_window; // window holding our inbox for this side
+    MPI_Win outbox_window; // window holding the neighbor's inbox
+    mp_limb_t* inbox; // written by the neighbor, read by us
+    uint64_t inbox_limbs; // per slot
+    uint64_t inbox_slots; // taken in turn
+    mp_limb_t* outbox; // the neighbor's inbox, written by us
+    uint64_t outbox_limbs; // per slot
+    uint64_t outbox_slots;
+    uint64_t inbox_turn; // carries received so far
+    uint64_t outbox_turn; // carries sent so far
+    uint64_t steps; // since the last carry going left over this link
+    carry_header_t pending_header; // of the carry being sent
+    MPI_Request pending[2]; // header and raw payload
+    fmpz pending_carry; // keeps a carry sent without waiting alive, or the packed lanes
+    bool sending;
+    struct link* peer; // the neighbor's end, if it's a segment of our rank
+    fmpz* queue; // carries from the peer, inbox_slots of them with one fmpz per lane
+} link_t;
+
+// With several segments per rank, they share the MPI side, and only
+// the bottom one's right link and the top one's left link use it.
+typedef struct transport {
+    MPI_Comm comm; // one rank per group of segments, ranked by chain position
+    MPI_Comm node;
+    MPI_Win from_left; // inboxes for carries from rank+1
+    MPI_Win from_right; // inboxes for carries from rank-1
+    link_t left;
+    link_t right;
+    fmpz scratch; // landing space for payloads sent through MPI
+    bool left_due; // the carry from the left isn't added yet
+    fibers_t* fibers; // the rank's segments, nullptr if it runs just one
+    bool owns_mpi; // frees the comms, windows and fibers
+} transport_t;
+
+// The segments this rank runs, consecutive in the chain from the bottom
+// up. Every rank has to call it at the same time.
+void transport_init(const std::vector<data_t*>&);
+void transport_finalize(data_t*);
+
+// Blocking, to rank in comm. The chain's carries go through
+// transport->comm instead, see below.
+void send(metrics_t*, MPI_Comm, int rank, int d, fmpz_t);
+void recv(metrics_t*, MPI_Comm, int rank, int d, fmpz_t);
+
+// Carries are arrays with one entry per lane.
+// Receives add the carry onto x, so that co-located neighbors can be
+// added straight out of shared memory. They return false if the carry
+// was zero in every lane. Sends to a segment of the same rank take the
+// carry out of x, leaving zeros.
 // might eventually need to pass a shift along with it
-void sendLeft(data_t*, fmpz_t);
-void receiveLeft(data_t*, fmpz_t);
-void sendRight(data_t*, fmpz_t);
-void receiveRight(data_t*, fmpz_t);
+void sendLeft(data_t*, fmpz*);
+bool receiveLeftAdd(data_t*, fmpz*);
+// Takes the carry out of x and returns before it's delivered.
+void startSendLeft(data_t*, fmpz*);
+void finishSendLeft(data_t*);
+// With lazy carries, whether this step of the link carries left.
+// Both ends call it once per step and so agree on the answer.
+bool carry_due(data_t*, link_t*);
+void sendRight(data_t*, fmpz*);
+bool receiveRightAdd(data_t*, fmpz*);
 
 void gather(data_t*, fmpz_t, fmpz*, int);
+// No segment of the chain goes on before all of them got here. The
+// segments of a rank meet first, so it works with fibers too.
+void chain_barrier(data_t*);
 
 #endif // COMMUNICATE_H
-
@@ -0,0 +1,22 @@
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <cstdint>
+#include <string>
+
+#include "segment.h"
+
+// The whole distributed integer as one little-endian run of limbs in
+// a single file, written and read by all ranks at once through MPI-IO.
+// Each block lands at its global offset, so a dump can seed a run
+// under any config and world size.
+void write_dump(data_t*, const std::string& filename, int64_t iterations);
+// Replaces the stored blocks with the dump's and returns its iteration
+// count.
+int64_t read_dump(data_t*, const std::string& filename);
+
+// Carries every block's overflow into the block above, along the whole
+// chain, so that block j holds exactly the bits of its own range.
+void resolve_carries(data_t*);
+
+#endif // DUMP_H
@@ -0,0 +1,48 @@
+#ifndef FIBERS_H
+#define FIBERS_H
+
+#include <ucontext.h>
+#include <flint/fmpz.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Several segments of the chain can share one rank, each on its own
+// stack, taking turns on the rank's thread. A segment only gives up
+// its turn where it would otherwise block on a neighbor, so the time
+// one of them spends waiting goes to grinding another.
+typedef struct fiber {
+    ucontext_t context;
+    void* stack;
+    size_t stack_bytes;
+    void (*run)(void*);
+    void* arg;
+    bool done;
+} fiber_t;
+
+typedef struct fibers {
+    ucontext_t scheduler;
+    std::vector<fiber_t*> list;
+    size_t current;
+    // rank-wide sums, see fibers_sum
+    fmpz sum;
+    uint64_t arrived;
+    uint64_t generation;
+} fibers_t;
+
+fibers_t* fibers_create();
+void fibers_spawn(fibers_t*, void (*run)(void*), void* arg);
+// Round robin until every fiber has returned.
+void fibers_run(fibers_t*);
+// Back to the scheduler, which resumes the next fiber that isn't done.
+void fibers_yield(fibers_t*);
+void fibers_destroy(fibers_t*);
+
+// Every fiber calls it in turn with its own x. The first one waits
+// for the others, gets the sum in x and returns true; the others
+// return false once it has taken the sum.
+bool fibers_sum(fibers_t*, fmpz_t x, bool first);
+
+void test_fibers();
+
+#endif // FIBERS_H
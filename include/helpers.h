@@ -0,0 +1,36 @@
+#ifndef HELPERS_H
+#define HELPERS_H
+
+#include <flint/fmpz.h>
+#include <cstdint>
+#include <vector>
+
+#include "common.h"
+#include "segment.h"
+
+// The top segment's products with large powers of 3 can be shared with
+// helper ranks past the end of the chain. With 3^d - 1 helpers, d levels
+// of Karatsuba split x and the power into 3^d pieces each: the low
+// half, the high half and their sum at every level. Every rank of the
+// group multiplies one pair, and the top segment puts the products back
+// together. The split points only depend on the power, so every helper
+// cuts its own piece of the power once and only pieces of x travel.
+
+// Runs on the helper ranks until the top segment is done.
+void helpers_serve(config_t*, int world_rank, int chain_size);
+// Whether the product with p3[e] goes to the helpers.
+bool helped(data_t*, uint64_t e);
+// rop = x*p3[e], rop may alias x.
+void helped_mul(data_t*, fmpz_t rop, const fmpz_t x, uint64_t e);
+void helpers_finalize(data_t*);
+
+// Karatsuba levels for a group of this many helpers, -1 if there are
+// none or they don't make up a group.
+int helper_depth(uint64_t helpers);
+void karatsuba_pieces(const fmpz_t x, const fmpz_t p, int depth, std::vector<fmpz>* pieces, std::vector<uint64_t>* splits);
+void karatsuba_piece(fmpz_t rop, const fmpz_t p, int depth, uint64_t k);
+void karatsuba_combine(fmpz_t rop, const fmpz* products, const uint64_t** splits, int depth);
+
+void test_karatsuba_pieces();
+
+#endif // HELPERS_H
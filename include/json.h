@@ -0,0 +1,32 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+#include <vector>
+
+// Just enough JSON to read back what our own tools write.
+
+enum json_type {
+    json_null,
+    json_bool,
+    json_number,
+    json_string,
+    json_array,
+    json_object,
+};
+
+typedef struct json {
+    json_type type;
+    double number; // also holds bools as 0/1
+    std::string string;
+    std::vector<struct json> items; // array elements, or object values
+    std::vector<std::string> keys; // object keys, parallel to items
+} json_t;
+
+bool parse_json(const std::string&, json_t*);
+bool read_json_file(const char*, json_t*);
+const json_t* json_get(const json_t*, const char*);
+
+void test_parse_json();
+
+#endif // JSON_H
@@ -0,0 +1,86 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#ifdef FLINT_HAVE_FFT_SMALL
+#include <flint/fft_small.h>
+#endif
+
+// Backends for the limb multiplications in the kernels below.
+// mul writes an+bn limbs to r, and needs an >= bn >= 1.
+struct flint_backend {
+    static constexpr const char* name = "flint";
+    static void mul(mp_ptr r, mp_srcptr a, mp_size_t an, mp_srcptr b, mp_size_t bn) {
+        flint_mpn_mul(r, a, an, b, bn);
+    }
+};
+
+struct gmp_backend {
+    static constexpr const char* name = "gmp";
+    static void mul(mp_ptr r, mp_srcptr a, mp_size_t an, mp_srcptr b, mp_size_t bn) {
+        mpn_mul(r, a, an, b, bn);
+    }
+};
+
+#ifdef FLINT_HAVE_FFT_SMALL
+// FLINT's small prime FFT at every size, without flint_mpn_mul's cutoffs
+struct fft_small_backend {
+    static constexpr const char* name = "fft_small";
+    static void mul(mp_ptr r, mp_srcptr a, mp_size_t an, mp_srcptr b, mp_size_t bn) {
+        mpn_mul_default_mpn_ctx(r, a, an, b, bn);
+    }
+};
+#endif
+
+// Limbs of a nonnegative fmpz, small values included. Those are copied
+// to single, which has to outlive the span. The kernels, the transport
+// and the files all read blocks through these.
+typedef struct limb_span {
+    mp_srcptr limbs;
+    mp_size_t size;
+} limb_span_t;
+
+limb_span_t limbs_of(const fmpz_t, mp_limb_t* single);
+
+// The bits of a nonnegative fmpz from bit `from` on, as a view on its
+// limbs, which start `shift` bits below `from`. Block sizes are powers
+// of two, so splits at blocks of 2^6 bits and more fall on a limb
+// boundary and view x >> from without copying anything.
+typedef struct bit_slice {
+    mp_srcptr limbs;
+    mp_size_t size;
+    unsigned shift;
+} bit_slice_t;
+
+bit_slice_t slice_of(const fmpz_t, mp_limb_t* single, flint_bitcnt_t from);
+// The limbs of a slice. Only one that is off a limb boundary is
+// shifted, into buffer, which has room for its size.
+limb_span_t slice_limbs(bit_slice_t, mp_ptr buffer);
+
+// Chosen at build time, e.g. make BACKEND=gmp
+#ifndef HYDRA_BACKEND
+#define HYDRA_BACKEND flint_backend
+#endif
+typedef HYDRA_BACKEND backend_t;
+
+// high = floor(x*y / 2^bits) + add, low = x*y mod 2^bits
+// The product is written once and split in place, instead of going
+// through a temporary and two copies. All values are nonnegative.
+// high may alias x, low may not alias anything.
+template<typename backend> void mul_split_with(fmpz_t high, fmpz_t low, const fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t bits);
+void mul_split(fmpz_t high, fmpz_t low, const fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t bits);
+// x = floor(x / 2^from)*y + add, reading x >> from through a slice
+void mul_add(fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t from);
+// rop += x*2^bits, adding x at its place rather than shifting a copy.
+// rop may not alias x.
+void add_2exp(fmpz_t rop, const fmpz_t x, flint_bitcnt_t bits);
+// high = floor(x / 2^bits), low = x mod 2^bits. x may be either of
+// them and then keeps its limbs, which FLINT's 2exp functions replace
+// by exactly sized ones when they work in place.
+void split_2exp(fmpz_t high, fmpz_t low, const fmpz_t x, flint_bitcnt_t bits);
+
+void test_mul_split();
+
+#endif // KERNEL_H
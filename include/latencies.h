@@ -2,12 +2,24 @@
 #define LATENCIES_H
 
 #include <vector>
+#include <string>
+#include <cstdint>
 
 template<typename T> using vec = std::vector<T>;
 
+enum latencies_mode {
+    // every pair of ranks swaps in turn, one pair at a time
+    mode_pairs,
+    // all neighbors exchange at once, the way recursive_burn does
+    mode_chain,
+};
+
 typedef struct latencies_config {
-    vec<uint64_t> sizes;
-    vec<uint64_t> counts;
+    vec<uint64_t> sizes; // log bits per message
+    vec<uint64_t> counts; // repetitions per size
+    latencies_mode mode;
+    std::string output; // "-" for stdout
+    bool verbose;
 } latencies_config_t;
 
 // one of these for every pair of nodes
@@ -22,9 +34,11 @@ typedef struct latency_matrix {
     double* stddevs;
 } latency_matrix_t;
 
+void parse_latencies_args(latencies_config_t* config, int argc, char** argv);
+
+void test_parse_latencies_args();
 void test_get_opponent();
 vec<latency_matrix_t> gather_stats(latencies_config_t* config, int rank, int world_size);
 void print_stats(latencies_config_t* config, int world_rank, int world_size, vec<latency_matrix_t> stats);
 
 #endif // LATENCIES_H
-
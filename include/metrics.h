@@ -23,10 +23,27 @@ enum timer_class {
     grinding_basecase,
     grinding_chain,
     gather_communication,
+    waiting_powers,
+    allocator_faulting,
     active_time,
     _timer_classes,
 };
 
+extern const char* timer_class_names[];
+
+// The classes that don't nest inside each other, i.e. what a rank can
+// be doing at any moment. The (mpi) and (copying) parts are left out.
+inline constexpr timer_class top_level[] = {
+    initializing,
+    grinding_basecase,
+    grinding_chain,
+    waiting_send_left,
+    waiting_recv_left,
+    waiting_send_right,
+    waiting_recv_right,
+    gather_communication,
+};
+
 typedef std::chrono::high_resolution_clock hydra_clock;
 typedef std::chrono::time_point<hydra_clock> start_time_t;
 
@@ -44,6 +61,16 @@ typedef struct timers {
 enum counter_class {
     messages_received_right,
     messages_received_right_nonempty,
+    carries_sent_empty,
+    carries_sent_inline,
+    multiplications_helped,
+    steps_dormant,
+    top_blocks_grown,
+    blocks_reserved,
+    allocator_allocations,
+    allocator_reallocations,
+    allocator_bytes_copied,
+    allocator_bytes_mapped,
     _counter_classes,
 };
 
@@ -52,20 +79,76 @@ typedef struct counters {
     uint64_t counter[_counter_classes];
 } counters_t;
 
+// Optional hardware counters, read whenever a top level timer or the
+// whole run's starts or stops, so those classes get the cycles,
+// instructions and last level cache misses while they ran. Each read is
+// a syscall, so the nested (mpi) and (copying) timers go without.
+// Threads started after the counters, like FLINT's, count along, unless
+// the kernel can't read inherited groups; then it's the calling thread.
+enum hardware_event {
+    hardware_cycles,
+    hardware_instructions,
+    hardware_cache_misses,
+    _hardware_events,
+};
+
+typedef struct hardware {
+    bool on;
+    bool inherited; // counts the threads started since
+    int fd; // group leader
+    uint64_t last_start[_timer_classes][_hardware_events];
+    uint64_t total[_timer_classes][_hardware_events];
+} hardware_t;
+
+// Optional profile of the funnel and the blocks, per block counted from
+// the bottom of the segment and per log size e of the step, as the time
+// in multiplications against the time in splits and adds. Blocks past
+// the last level, like many grown on top, share its entries.
+enum profile_kind {
+    profile_multiply,
+    profile_split,
+    _profile_kinds,
+};
+
+const int profile_levels = 32;
+const int profile_exponents = 64;
+
+typedef struct level_profile {
+    uint64_t calls[_profile_kinds];
+    uint64_t bits[_profile_kinds]; // operands, summed over the calls
+    std::chrono::nanoseconds time[_profile_kinds];
+} level_profile_t;
+
+typedef struct profile {
+    level_profile_t entry[profile_levels][profile_exponents];
+} profile_t;
+
 typedef struct metrics {
     timers_t timers;
     counters_t counters;
+    hardware_t hardware;
+    profile_t* profile; // null unless profiling
 } metrics_t;
 
 start_time_t nanos();
 double seconds(std::chrono::nanoseconds);
 
 void init_metrics(metrics_t*, bool);
+// Before any timer starts. Goes on without them if the kernel says no.
+void hardware_open(metrics_t*);
+void hardware_close(metrics_t*);
+
+void profile_init(metrics_t*);
+level_profile_t* profile_entry(metrics_t*, int level, uint64_t e);
+// One call of the kind since start, with operands of this many bits.
+void profile_count(level_profile_t*, profile_kind, uint64_t bits, start_time_t start);
 
 void timer_start(metrics_t*, timer_class);
 void timer_stop(metrics_t*, timer_class);
+void timer_add(metrics_t*, timer_class, std::chrono::nanoseconds);
 
 void counter_count(metrics_t*, counter_class);
+void counter_add(metrics_t*, counter_class, uint64_t);
 
 void dump_metrics(metrics_t*, int);
 
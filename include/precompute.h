@@ -0,0 +1,45 @@
+#ifndef PRECOMPUTE_H
+#define PRECOMPUTE_H
+
+#include <gmp.h>
+#include <flint/fmpz.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "segment.h"
+
+// Powers of three p3[i] = 3^(2^i) shared by the chain and funnel.
+// With a cache directory they are memory-mapped from p3-v<version>.bin
+// (read-only views, never written through). Otherwise, or when the file
+// is too short, a background thread squares them up in ascending order
+// and `power_of_3` blocks only when the recursion outruns it.
+typedef struct precompute {
+    std::vector<fmpz>* p3; // pre-sized, entries below `ready` are valid
+    std::vector<__mpz_struct> powers; // what large p3 entries point to
+    std::atomic<uint64_t> ready;
+    std::atomic<bool> stop;
+    std::mutex lock;
+    std::condition_variable filled;
+    std::thread filler;
+    uint64_t mapped; // leading entries that are views into the cache file
+    void* mapping;
+    size_t mapping_bytes;
+    std::string cache_dir;
+} precompute_t;
+
+precompute_t* precompute_start(std::vector<fmpz>* p3, uint64_t count, const std::string& cache_dir);
+void precompute_wait(precompute_t*, uint64_t e);
+void precompute_stop(precompute_t*);
+
+void precompute_init(data_t*);
+const fmpz* power_of_3(data_t*, uint64_t e);
+void precompute_finalize(data_t*);
+
+void test_precompute();
+
+#endif // PRECOMPUTE_H
@@ -10,17 +10,28 @@
 
 using basecase_table_t = uint32_t;
 
+typedef struct transport transport_t; // see communicate.h
+typedef struct precompute precompute_t; // see precompute.h
+
+// Every block holds one number per lane, one lane per starting value.
+// The lanes of a block sit next to each other, block i lane j at
+// i*lanes + j, so that they can be handed around as one array.
 typedef struct vars {
-    fmpz update;
+    std::vector<fmpz> update; // per lane
     std::vector<fmpz> p3;
     std::vector<fmpz> tmp;
     std::vector<fmpz> stored;
+    uint64_t lanes;
     basecase_table_t* basecase_table;
     uint64_t p3base;
     uint64_t table_bits;
 
     std::vector<uint64_t> block_size; // from left to right, including input (stored) and output (not stored) sizes; log length
     std::vector<uint64_t> global_offset; // number of bits from the basecase
+    std::vector<uint64_t> funnel_bits; // log arity of the funnel down to each block
+    precompute_t* precompute; // fills p3, or the top segment's of the rank; read it through power_of_3
+    bool dormant; // this step, see segment_wake
+    bool left_dormant;
 } vars_t;
 
 typedef struct data {
@@ -29,19 +40,38 @@ typedef struct data {
     segment_t* segment;
     vars_t* vars;
     metrics_t* metrics;
+    transport_t* transport;
 } data_t;
 
-data_t* segment_init(problem_t*, config_t*, segment_t*);
+// The consecutive segments this rank runs, from the bottom up.
+std::vector<data_t*> segment_init(problem_t*, config_t*, segment_t* segments, int count);
+void segment_wake(data_t*, int64_t iterations);
 int segment_burn(data_t*, int64_t);
+void segment_settle(data_t*);
+// The top segment stacks blocks of its top block's size on it until no
+// lane spills past it.
+void grow_top(data_t*);
 void segment_finalize(data_t*);
 
 // internal objects exposed for benchmarking
 void init_table(vars_t* vars, uint64_t power);
-void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block);
+// One segment on its own, without MPI, a config or a transport, for the
+// tests and benchmarks. Blocks are given from the top down, every funnel
+// is binary, and the table has 2^table_bits entries (none for 0). The
+// powers of 3 are up to the caller; lone_segment_clear stops them.
+data_t* lone_segment_init(const std::vector<uint64_t>& block_size, uint64_t lanes, uint64_t table_bits);
+void lone_segment_clear(data_t*);
+void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block, uint64_t lane);
+// rop and add have one entry per lane
+void recursive_burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e, int i);
+// recursive_burn from the top block, or its fixed layout counterpart
+void burn_blocks(data_t* data, fmpz* rop, fmpz* add, uint64_t e);
+
+void test_funnel_arity();
 
 void print_segment_blocks(data_t*);
 void print_smallest_mod(data_t*, uint64_t);
-void print_signature(data_t*, uint64_t, uint64_t);
+void signature(data_t*, uint64_t lane, uint64_t base, uint64_t exp, fmpz_t rop);
 void print_special_2exp(data_t*, int64_t);
 
 #endif // SEGMENT_H
@@ -0,0 +1,17 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <vector>
+#include <cstdint>
+
+#include "segment.h"
+
+// Picks the chain position of this rank, according to --topology,
+// and stores it in segment->world_rank. Collective.
+void order_chain(data_t*);
+
+std::vector<int> chain_order(const std::vector<std::vector<double>>& costs, const std::vector<uint64_t>& sizes, const std::vector<uint64_t>& link_sizes, int n);
+
+void test_chain_order();
+
+#endif // TOPOLOGY_H
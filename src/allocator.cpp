@@ -0,0 +1,273 @@
+#include <gmp.h>
+#include <flint/flint.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "allocator.h"
+#include "metrics.h"
+#include "friendly_assert.h"
+
+// Every block starts with a header, so that FLINT's free and realloc,
+// which don't pass the size, know what they are dealing with.
+enum block_kind : uint64_t {
+    kind_pooled,
+    kind_malloc,
+    kind_mapped,
+};
+
+typedef struct block_header {
+    uint64_t capacity; // usable bytes after the header
+    uint64_t kind;
+} block_header_t;
+
+static_assert(sizeof(block_header_t) == 16, "headers keep blocks 16 byte aligned");
+
+const int smallest_class = 5; // 32 bytes, header included
+const int largest_class = 16; // 64 KiB
+const size_t huge_page = (size_t)1<<21;
+const size_t mapped_threshold = huge_page;
+
+typedef struct pool {
+    std::mutex lock;
+    void* free_list; // the first word of a free block points to the next
+} pool_t;
+
+static pool_t pools[largest_class+1];
+
+// FLINT may allocate from several threads at once.
+static std::atomic<uint64_t> allocations {0};
+static std::atomic<uint64_t> reallocations {0};
+static std::atomic<uint64_t> realloc_bytes_copied {0};
+static std::atomic<uint64_t> bytes_mapped {0};
+static std::atomic<int64_t> fault_nanos {0};
+
+static void* block_data(block_header_t* header) {
+    return header+1;
+}
+
+static block_header_t* block_of(void* p) {
+    return static_cast<block_header_t*>(p)-1;
+}
+
+static int size_class(size_t bytes) {
+    int c = smallest_class;
+    while (((size_t)1<<c) < bytes + sizeof(block_header_t)) {
+        c++;
+    }
+    return c;
+}
+
+#ifdef __linux__
+// Faults in [start, start+bytes) up front, so that it happens in
+// one go and can be timed, instead of page by page during a multiply.
+static void prefault(char* start, size_t bytes) {
+    const auto begin = nanos();
+    #ifdef MADV_POPULATE_WRITE
+    if (madvise(start, bytes, MADV_POPULATE_WRITE) != 0)
+    #endif
+    {
+        for (size_t i = 0; i < bytes; i += 4096) {
+            start[i] = 0;
+        }
+    }
+    const auto end = nanos();
+    fault_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+}
+
+static size_t mapping_bytes(size_t bytes) {
+    const size_t total = bytes + sizeof(block_header_t);
+    return (total + huge_page-1) / huge_page * huge_page;
+}
+
+static void* map_block(size_t bytes) {
+    const size_t length = mapping_bytes(bytes);
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    friendly_assert(p != MAP_FAILED, "Could not map memory for a large integer.");
+    #ifdef MADV_HUGEPAGE
+    madvise(p, length, MADV_HUGEPAGE);
+    #endif
+    prefault(static_cast<char*>(p), length);
+    bytes_mapped += length;
+    block_header_t* header = static_cast<block_header_t*>(p);
+    *header = {.capacity = length - sizeof(block_header_t), .kind = kind_mapped};
+    return block_data(header);
+}
+
+// Moving pages around is cheaper than copying them.
+static void* remap_block(block_header_t* header, size_t bytes) {
+    const size_t old_length = header->capacity + sizeof(block_header_t);
+    const size_t length = mapping_bytes(bytes);
+    void* p = mremap(header, old_length, length, MREMAP_MAYMOVE);
+    friendly_assert(p != MAP_FAILED, "Could not grow the mapping of a large integer.");
+    prefault(static_cast<char*>(p) + old_length, length - old_length);
+    bytes_mapped += length - old_length;
+    header = static_cast<block_header_t*>(p);
+    header->capacity = length - sizeof(block_header_t);
+    return block_data(header);
+}
+#endif
+
+void* pool_alloc(size_t bytes) {
+    allocations++;
+    const int c = size_class(bytes);
+    if (c <= largest_class) {
+        pool_t* pool = &pools[c];
+        void* p;
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            p = pool->free_list;
+            if (p != nullptr) {
+                pool->free_list = *static_cast<void**>(p);
+            }
+        }
+        if (p == nullptr) {
+            p = malloc((size_t)1<<c);
+            friendly_assert(p != nullptr, "Out of memory.");
+        }
+        block_header_t* header = static_cast<block_header_t*>(p);
+        *header = {.capacity = ((size_t)1<<c) - sizeof(block_header_t), .kind = kind_pooled};
+        return block_data(header);
+    }
+    #ifdef __linux__
+    if (bytes >= mapped_threshold) {
+        return map_block(bytes);
+    }
+    #endif
+    block_header_t* header = static_cast<block_header_t*>(malloc(bytes + sizeof(block_header_t)));
+    friendly_assert(header != nullptr, "Out of memory.");
+    *header = {.capacity = bytes, .kind = kind_malloc};
+    return block_data(header);
+}
+
+void pool_free(void* p) {
+    if (p == nullptr) {
+        return;
+    }
+    block_header_t* header = block_of(p);
+    switch (header->kind) {
+    case kind_pooled:
+        {
+            pool_t* pool = &pools[size_class(header->capacity)];
+            std::lock_guard<std::mutex> guard(pool->lock);
+            *reinterpret_cast<void**>(header) = pool->free_list;
+            pool->free_list = header;
+        }
+        break;
+    case kind_malloc:
+        free(header);
+        break;
+    #ifdef __linux__
+    case kind_mapped:
+        munmap(header, header->capacity + sizeof(block_header_t));
+        break;
+    #endif
+    default:
+        assert(false);
+    }
+}
+
+void* pool_realloc(void* p, size_t bytes) {
+    if (p == nullptr) {
+        return pool_alloc(bytes);
+    }
+    reallocations++;
+    block_header_t* header = block_of(p);
+    if (bytes <= header->capacity) {
+        return p;
+    }
+    #ifdef __linux__
+    if (header->kind == kind_mapped) {
+        return remap_block(header, bytes);
+    }
+    #endif
+    if (header->kind == kind_malloc && bytes < mapped_threshold) {
+        const uint64_t old_capacity = header->capacity;
+        block_header_t* moved = static_cast<block_header_t*>(realloc(header, bytes + sizeof(block_header_t)));
+        friendly_assert(moved != nullptr, "Out of memory.");
+        if (moved != header) {
+            realloc_bytes_copied += old_capacity;
+        }
+        moved->capacity = bytes;
+        return block_data(moved);
+    }
+    void* q = pool_alloc(bytes);
+    memcpy(q, p, header->capacity);
+    realloc_bytes_copied += header->capacity;
+    pool_free(p);
+    return q;
+}
+
+static void* gmp_realloc(void* p, size_t, size_t bytes) {
+    return pool_realloc(p, bytes);
+}
+
+static void gmp_free(void* p, size_t) {
+    pool_free(p);
+}
+
+static void* flint_calloc_pooled(size_t count, size_t size) {
+    void* p = pool_alloc(count*size);
+    memset(p, 0, count*size);
+    return p;
+}
+
+void allocator_install() {
+    mp_set_memory_functions(pool_alloc, gmp_realloc, gmp_free);
+    __flint_set_memory_functions(pool_alloc, flint_calloc_pooled, pool_realloc, pool_free);
+}
+
+void allocator_collect(metrics_t* metrics) {
+    counter_add(metrics, allocator_allocations, allocations.exchange(0));
+    counter_add(metrics, allocator_reallocations, reallocations.exchange(0));
+    counter_add(metrics, allocator_bytes_copied, realloc_bytes_copied.exchange(0));
+    counter_add(metrics, allocator_bytes_mapped, bytes_mapped.exchange(0));
+    timer_add(metrics, allocator_faulting, std::chrono::nanoseconds(fault_nanos.exchange(0)));
+}
+
+void test_allocator() {
+    // grow one block through every kind, checking it keeps its contents
+    uint64_t* p = static_cast<uint64_t*>(pool_alloc(8));
+    p[0] = 12345;
+    size_t words = 1;
+    while (words < ((size_t)1<<20)) {
+        const size_t more = words*3;
+        p = static_cast<uint64_t*>(pool_realloc(p, more*8));
+        for (size_t i = words; i < more; i++) {
+            p[i] = i;
+        }
+        assert(p[0] == 12345);
+        assert(p[words-1] == (words == 1 ? 12345 : words-1));
+        words = more;
+    }
+    pool_free(p);
+
+    // freed small blocks get reused
+    void* a = pool_alloc(100);
+    pool_free(a);
+    void* b = pool_alloc(90);
+    assert(a == b);
+    pool_free(b);
+
+    uint64_t* z = static_cast<uint64_t*>(flint_calloc_pooled(1000, 8));
+    for (int i = 0; i < 1000; i++) {
+        assert(z[i] == 0);
+    }
+    pool_free(z);
+    pool_free(nullptr);
+
+    metrics_t metrics = {};
+    init_metrics(&metrics, false);
+    allocator_collect(&metrics);
+    assert(metrics.counters.counter[allocator_allocations] >= 4);
+    assert(metrics.counters.counter[allocator_reallocations] > 0);
+    assert(metrics.counters.counter[allocator_bytes_copied] > 0);
+    assert(allocations == 0);
+}
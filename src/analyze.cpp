@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "analyze.h"
+#include "json.h"
+#include "metrics.h"
+#include "friendly_assert.h"
+
+static struct option longopts[] = {
+    { "min-wait",   required_argument,  NULL, 'm' },
+    { NULL,         0,                  NULL,  0  },
+};
+
+void parse_analyze_args(analyze_config_t* config, int argc, char** argv) {
+    *config = {
+        .min_wait = 1e-5,
+        .files = {},
+    };
+    int ch;
+    while((ch = getopt_long_only(argc, argv, "m:", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 'm':
+            config->min_wait = std::strtod(optarg, nullptr);
+            break;
+        case 0:
+            fprintf(stderr, "arg parse discovered null argument\n");
+            break;
+        }
+    }
+    for (int i = optind; i < argc; i++) {
+        config->files.push_back(argv[i]);
+    }
+    friendly_assert(config->files.size() > 0, "Usage: analyze [--min-wait seconds] rank0.json rank1.json ...");
+}
+
+// The files are fragments of one object, as written by dump_metrics:
+//  ,"rank 3": {"actively": [[0,1.5]], ...}
+bool read_trace(const char* filename, rank_trace_t* trace) {
+    std::ifstream f {filename};
+    if (!f) { return false; }
+    std::stringstream text;
+    text << f.rdbuf();
+    std::string fragment = text.str();
+    const size_t begin = fragment.find('"');
+    if (begin == std::string::npos) { return false; }
+    json_t j;
+    if (!parse_json("{" + fragment.substr(begin) + "}", &j) || j.keys.size() != 1) { return false; }
+    if (sscanf(j.keys[0].c_str(), "rank %d", &trace->rank) != 1) { return false; }
+    const json_t* timers = &j.items[0];
+    for (int t = 0; t < _timer_classes; t++) {
+        trace->intervals[t] = {};
+        const json_t* list = json_get(timers, timer_class_names[t]);
+        trace->logged[t] = list != nullptr;
+        if (list == nullptr) { continue; }
+        for (const json_t& pair : list->items) {
+            if (pair.items.size() != 2) { return false; }
+            trace->intervals[t].push_back({pair.items[0].number, pair.items[1].number});
+        }
+    }
+    return true;
+}
+
+// Time covered by sorted, disjoint intervals within [a, b].
+double overlap(const std::vector<interval_t>& intervals, double a, double b) {
+    auto it = std::lower_bound(intervals.begin(), intervals.end(), a, [](const interval_t& i, double t) { return i.stop <= t; });
+    double total = 0;
+    for (; it != intervals.end() && it->start < b; it++) {
+        total += std::min(it->stop, b) - std::max(it->start, a);
+    }
+    return total;
+}
+
+double total(const std::vector<interval_t>& intervals) {
+    double sum = 0;
+    for (const interval_t& i : intervals) {
+        sum += i.stop - i.start;
+    }
+    return sum;
+}
+
+double end_time(const rank_trace_t& trace) {
+    double end = 0;
+    for (int t = 0; t < _timer_classes; t++) {
+        if (!trace.intervals[t].empty()) {
+            end = std::max(end, trace.intervals[t].back().stop);
+        }
+    }
+    return end;
+}
+
+// Latest wait of at least min_wait that ends before T, or nullptr.
+const interval_t* latest_wait(const std::vector<interval_t>& waits, double T, double min_wait) {
+    auto it = std::lower_bound(waits.begin(), waits.end(), T, [](const interval_t& i, double t) { return i.stop < t; });
+    while (it != waits.begin()) {
+        it--;
+        if (it->stop - it->start >= min_wait) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+// Walks back from the rank that finished last. Whenever a rank was
+// blocked on a receive, whoever it was waiting for is what held the
+// run back, so the path continues on that neighbor from the moment
+// the wait ended.
+critical_path_t find_critical_path(const std::vector<rank_trace_t>& traces, double min_wait) {
+    const int n = traces.size();
+    critical_path_t path = {
+        .length = 0,
+        .jumps = 0,
+        .rank_time = std::vector<double>(n, 0),
+        .class_time = std::vector<std::vector<double>>(n, std::vector<double>(_timer_classes, 0)),
+    };
+    int r = 0;
+    for (int k = 1; k < n; k++) {
+        if (end_time(traces[k]) > end_time(traces[r])) { r = k; }
+    }
+    double T = end_time(traces[r]);
+    auto attribute = [&](int rank, double a, double b) {
+        path.rank_time[rank] += b - a;
+        path.length += b - a;
+        for (timer_class c : top_level) {
+            path.class_time[rank][c] += overlap(traces[rank].intervals[c], a, b);
+        }
+    };
+    while (true) {
+        const interval_t* left = latest_wait(traces[r].intervals[waiting_recv_left], T, min_wait);
+        const interval_t* right = latest_wait(traces[r].intervals[waiting_recv_right], T, min_wait);
+        const interval_t* wait = left;
+        int from = r+1;
+        if (right != nullptr && (left == nullptr || right->stop > left->stop)) {
+            wait = right;
+            from = r-1;
+        }
+        if (wait == nullptr) {
+            attribute(r, 0, T);
+            break;
+        }
+        attribute(r, wait->stop, T);
+        T = wait->stop;
+        if (from < 0 || from >= n) {
+            // nobody to blame, the wait itself is on the path
+            attribute(r, wait->start, T);
+            T = wait->start;
+            continue;
+        }
+        r = from;
+        path.jumps += 1;
+    }
+    return path;
+}
+
+// Largest amount by which a receive on one rank seems to finish
+// before the matching send on the other even started. The k-th
+// receive from a neighbor matches its k-th send in that direction.
+bool causality_gap(const std::vector<interval_t>& recvs, const std::vector<interval_t>& sends, double* gap) {
+    const size_t count = std::min(recvs.size(), sends.size());
+    if (count == 0) { return false; }
+    *gap = sends[0].start - recvs[0].stop;
+    for (size_t k = 1; k < count; k++) {
+        *gap = std::max(*gap, sends[k].start - recvs[k].stop);
+    }
+    return true;
+}
+
+// Each trace starts at its own rank's clock. A barrier lines them up
+// at the start, but that can be off by a lot on a loaded machine.
+// Neighbors are shifted against each other until no receive finishes
+// before its send started, to the extent both sides logged them.
+std::vector<double> align_clocks(std::vector<rank_trace_t>* traces) {
+    const int n = traces->size();
+    std::vector<double> offsets(n, 0);
+    for (int r = 0; r+1 < n; r++) {
+        const rank_trace_t& lower = (*traces)[r];
+        const rank_trace_t& upper = (*traces)[r+1];
+        // d is how far upper's clock is moved against lower's
+        double low = 0, high = 0;
+        const bool has_low = causality_gap(upper.intervals[waiting_recv_right], lower.intervals[waiting_send_left], &low);
+        const bool has_high = causality_gap(lower.intervals[waiting_recv_left], upper.intervals[waiting_send_right], &high);
+        high = -high;
+        double d = 0;
+        if (has_low && has_high) {
+            d = (low + high) / 2;
+        } else if (has_low) {
+            d = std::max(low, 0.0);
+        } else if (has_high) {
+            d = std::min(high, 0.0);
+        }
+        offsets[r+1] = offsets[r] + d;
+    }
+    for (int r = 0; r < n; r++) {
+        for (int t = 0; t < _timer_classes; t++) {
+            for (interval_t& i : (*traces)[r].intervals[t]) {
+                i.start += offsets[r];
+                i.stop += offsets[r];
+            }
+        }
+    }
+    return offsets;
+}
+
+double percent(double part, double whole) {
+    return whole > 0 ? 100*part/whole : 0;
+}
+
+void print_analysis(std::ostream& out, const std::vector<rank_trace_t>& unaligned, double min_wait) {
+    const int n = unaligned.size();
+    std::vector<rank_trace_t> traces = unaligned;
+    const std::vector<double> offsets = align_clocks(&traces);
+    const critical_path_t path = find_critical_path(traces, min_wait);
+    out << std::fixed << std::setprecision(6);
+    out << "clock offsets (s):";
+    for (double offset : offsets) {
+        out << " " << offset;
+    }
+    out << std::endl << std::setprecision(3);
+
+    out << "rank   active (s)   busy   bubbles (count, s)   critical path (s)" << std::endl;
+    std::vector<double> bubble_share(n, 0);
+    double all_active = 0;
+    for (int r = 0; r < n; r++) {
+        const rank_trace_t& trace = traces[r];
+        const double active = trace.intervals[active_time].empty() ? end_time(trace) : total(trace.intervals[active_time]);
+        all_active += active;
+        int bubbles = 0;
+        double bubble_time = 0;
+        for (timer_class c : {waiting_recv_left, waiting_recv_right}) {
+            for (const interval_t& i : trace.intervals[c]) {
+                if (i.stop - i.start >= min_wait) {
+                    bubbles += 1;
+                    bubble_time += i.stop - i.start;
+                }
+            }
+        }
+        // a rank with an empty trace has no share
+        bubble_share[r] = percent(bubble_time, active)/100;
+        out << std::setw(4) << r << std::setw(13) << active
+            << std::setw(6) << std::setprecision(0) << percent(active - bubble_time, active) << "%" << std::setprecision(3)
+            << std::setw(10) << bubbles << std::setw(11) << bubble_time
+            << std::setw(20) << path.rank_time[r] << std::endl;
+    }
+
+    out << std::endl << "Share of all active time per timer:" << std::endl;
+    for (timer_class c : top_level) {
+        double sum = 0;
+        std::vector<int> unlogged = {};
+        for (int r = 0; r < n; r++) {
+            sum += total(traces[r].intervals[c]);
+            if (!traces[r].logged[c]) { unlogged.push_back(r); }
+        }
+        if (static_cast<int>(unlogged.size()) == n) { continue; }
+        out << "\t" << std::setprecision(1) << std::setw(5) << percent(sum, all_active) << "% " << timer_class_names[c];
+        if (!unlogged.empty()) {
+            out << " (not logged by rank";
+            for (int r : unlogged) { out << " " << r; }
+            out << ")";
+        }
+        out << std::endl;
+    }
+    out << std::setprecision(3);
+
+    out << std::endl << "Critical path: " << path.length << " s, handed between ranks " << path.jumps << " times." << std::endl;
+    int pace = 0;
+    for (int r = 0; r < n; r++) {
+        if (path.rank_time[r] > path.rank_time[pace]) { pace = r; }
+        if (path.rank_time[r] <= 0) { continue; }
+        timer_class most = top_level[0];
+        for (timer_class c : top_level) {
+            if (path.class_time[r][c] > path.class_time[r][most]) { most = c; }
+        }
+        out << "\trank " << r << ": " << std::setprecision(1) << percent(path.rank_time[r], path.length) << std::setprecision(3)
+            << "%, mostly " << timer_class_names[most] << std::endl;
+    }
+
+    out << std::endl << "Rank " << pace << " sets the pace; give it less work, e.g. smaller blocks." << std::endl;
+    if (!traces[pace].logged[waiting_recv_left] || !traces[pace].logged[waiting_recv_right]) {
+        out << "(It didn't log all of its waits, which can overstate its share.)" << std::endl;
+    }
+    for (int r = 0; r < n; r++) {
+        if (r != pace && bubble_share[r] >= 0.2) {
+            out << "Rank " << r << " waits on its neighbors " << std::setprecision(0) << 100*bubble_share[r] << std::setprecision(3)
+                << "% of the time; it can take more work." << std::endl;
+        }
+    }
+}
+
+void test_critical_path() {
+    // rank 0 waits on rank 1 in the middle
+    rank_trace_t base = {};
+    base.rank = 0;
+    base.intervals[active_time] = {{0, 10}};
+    base.intervals[grinding_basecase] = {{0, 4}, {7, 10}};
+    base.intervals[waiting_recv_left] = {{4, 7}};
+    rank_trace_t top = {};
+    top.rank = 1;
+    top.intervals[active_time] = {{0, 9}};
+    top.intervals[grinding_chain] = {{0, 6.5}};
+    top.intervals[waiting_send_left] = {{6.5, 7}};
+    // too short to count as blocking
+    top.intervals[waiting_recv_right] = {{1, 1.000001}};
+    critical_path_t path = find_critical_path({base, top}, 1e-3);
+    assert(path.jumps == 1);
+    assert(path.length == 10);
+    assert(path.rank_time[0] == 3);
+    assert(path.rank_time[1] == 7);
+    assert(path.class_time[0][grinding_basecase] == 3);
+    assert(path.class_time[1][grinding_chain] == 6.5);
+    assert(path.class_time[1][waiting_send_left] == 0.5);
+
+    assert(overlap({{0, 1}, {2, 3}, {4, 5}}, 0.5, 4.5) == 2);
+
+    // rank 1's clock runs 2 ahead: it seems to send at 8 and 11 what
+    // rank 0 received by 7 and 10
+    rank_trace_t lower = {};
+    lower.intervals[waiting_recv_left] = {{5, 7}, {9, 10}};
+    lower.intervals[waiting_send_left] = {{7, 7.5}};
+    rank_trace_t upper = {};
+    upper.intervals[waiting_send_right] = {{8, 8.5}, {11, 11.5}};
+    upper.intervals[waiting_recv_right] = {{9, 9.5}};
+    std::vector<rank_trace_t> skewed = {lower, upper};
+    const std::vector<double> offsets = align_clocks(&skewed);
+    // at least -1, at most -2.5 from the two directions
+    assert(offsets[0] == 0 && offsets[1] == -1.75);
+    assert(skewed[1].intervals[waiting_send_right][0].start == 6.25);
+
+    // a rank that logged nothing doesn't turn the suggestions into nan
+    rank_trace_t empty = {};
+    empty.rank = 2;
+    std::ostringstream report;
+    print_analysis(report, {base, top, empty}, 1e-3);
+    assert(report.str().find("nan") == std::string::npos);
+}
@@ -0,0 +1,22 @@
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "analyze.h"
+#include "friendly_assert.h"
+
+int main(int argc, char** argv) {
+    analyze_config_t config;
+    parse_analyze_args(&config, argc, argv);
+
+    std::vector<rank_trace_t> traces(config.files.size());
+    for (size_t i = 0; i < config.files.size(); i++) {
+        friendly_assert(read_trace(config.files[i].c_str(), &traces[i]), "Could not read a rank trace.");
+    }
+    std::sort(traces.begin(), traces.end(), [](const rank_trace_t& a, const rank_trace_t& b) { return a.rank < b.rank; });
+    for (size_t i = 0; i < traces.size(); i++) {
+        friendly_assert(traces[i].rank == static_cast<int>(i), "Rank traces should be rank 0 up to some rank, each exactly once.");
+    }
+
+    print_analysis(std::cout, traces, config.min_wait);
+}
@@ -5,6 +5,70 @@
 
 #include "common.h"
 #include "segment.h"
+#include "kernel.h"
+#include "precompute.h"
+
+// Average time of one chain-shaped mul_split: 2^size bits times
+// 2^(size-1) bits, split at 2^(size-1).
+template<typename backend> double time_mul_split(uint64_t size, flint_rand_t rand) {
+    fmpz_t x, y, zero, high, low;
+    fmpz_init(x); fmpz_init(y); fmpz_init(zero); fmpz_init(high); fmpz_init(low);
+    fmpz_randbits_unsigned(x, rand, (uint64_t)1<<size);
+    fmpz_randbits_unsigned(y, rand, (uint64_t)1<<(size-1));
+    int repetitions = 0;
+    const start_time_t start = nanos();
+    double elapsed = 0;
+    while (elapsed < 0.05) {
+        mul_split_with<backend>(high, low, x, y, zero, (uint64_t)1<<(size-1));
+        repetitions++;
+        elapsed = seconds(nanos()-start);
+    }
+    fmpz_clear(x); fmpz_clear(y); fmpz_clear(zero); fmpz_clear(high); fmpz_clear(low);
+    return elapsed / repetitions;
+}
+
+// GMP's limbs, counted for the peak memory of the funnel.
+void* (*gmp_alloc)(size_t);
+void* (*gmp_realloc)(void*, size_t, size_t);
+void (*gmp_free)(void*, size_t);
+size_t live_bytes = 0;
+size_t peak_bytes = 0;
+
+void count_bytes(size_t freed, size_t allocated) {
+    live_bytes += allocated - freed;
+    peak_bytes = std::max(peak_bytes, live_bytes);
+}
+void* counting_alloc(size_t n) {
+    count_bytes(0, n);
+    return gmp_alloc(n);
+}
+void* counting_realloc(void* p, size_t old_n, size_t n) {
+    count_bytes(old_n, n);
+    return gmp_realloc(p, old_n, n);
+}
+void counting_free(void* p, size_t n) {
+    count_bytes(n, 0);
+    gmp_free(p, n);
+}
+
+// One step of a lone segment with blocks of 2^top and 2^bottom bits,
+// funneling down with the given arity.
+void time_funnel(data_t* data, uint64_t top, uint64_t arity_bits, flint_rand_t rand) {
+    vars_t* vars = data->vars;
+    vars->funnel_bits[1] = arity_bits;
+    fmpz_randbits_unsigned(&vars->stored[0], rand, (uint64_t)1<<top);
+    fmpz_randbits_unsigned(&vars->stored[1], rand, (uint64_t)1<<vars->block_size[1]);
+    fmpz_t carry, zero; fmpz_init(carry); fmpz_init(zero);
+    const size_t before = live_bytes;
+    peak_bytes = live_bytes;
+    const start_time_t start = nanos();
+    timer_start(data->metrics, grinding_chain);
+    recursive_burn(data, carry, zero, top, 0);
+    timer_stop(data->metrics, grinding_chain);
+    const double time = seconds(nanos()-start);
+    std::cout << "  " << ((uint64_t)1<<arity_bits) << "\t" << time << "\t" << (peak_bytes - before)/1024 << std::endl;
+    fmpz_clear(carry); fmpz_clear(zero);
+}
 
 int main() {
     // 17 seems to be optimal. It has one more addition step than 16,
@@ -12,16 +76,21 @@ int main() {
     const uint64_t power = 17;
     basecase_table_t* table = (basecase_table_t*) malloc(((uint64_t)1<<power) * sizeof(basecase_table_t));
     vars_t vars = {
-        .update = 0,
+        .update = {0},
         .p3 = {},
         .tmp = {0},
         .stored = {0},
+        .lanes = 1,
         .basecase_table = table,
         .p3base = 0,
         .table_bits = 0,
 
         .block_size = {8},
         .global_offset = {0},
+        .funnel_bits = {1},
+        .precompute = nullptr,
+        .dormant = false,
+        .left_dormant = false,
     };
     data_t data;
     data.vars = &vars;
@@ -51,7 +120,7 @@ int main() {
         fmpz_set_ui(out, 0);
         const start_time_t start = nanos();
         for (int iter = 0; iter < (1<<p); iter++) {
-            basecase_burn(&data, out, add, e, 0);
+            basecase_burn(&data, out, add, e, 0, 0);
             fmpz_mul_ui(out, out, 7); // scramble it a little
             fmpz_fdiv_q_2exp(add, out, e); // just truncate it to pass back
         }
@@ -71,6 +140,40 @@ int main() {
     }
     stddev /= double(max_attempts-1);
     std::cout << "Basecase mean: " << mean << " ± " << stddev << " s." << std::endl;
+
+    const uint64_t top = 20;
+    const uint64_t bottom = 12;
+    data_t* funnel_data = lone_segment_init({top, bottom}, 1, power);
+    vars_t* funnel_vars = funnel_data->vars;
+    funnel_vars->precompute = precompute_start(&funnel_vars->p3, top+1, "");
+    precompute_wait(funnel_vars->precompute, top);
+    // the powers are filled in off this thread, so count after that
+    mp_get_memory_functions(&gmp_alloc, &gmp_realloc, &gmp_free);
+    mp_set_memory_functions(counting_alloc, counting_realloc, counting_free);
+    std::cout << "Funnel from 2^" << top << " to 2^" << bottom << " bits, one step:" << std::endl;
+    std::cout << "  arity\tseconds\tpeak limb KiB" << std::endl;
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    for (uint64_t arity_bits = 1; arity_bits <= top-bottom; arity_bits++) {
+        time_funnel(funnel_data, top, arity_bits, rand);
+    }
+    mp_set_memory_functions(gmp_alloc, gmp_realloc, gmp_free);
+    lone_segment_clear(funnel_data);
+
+    std::cout << "Multiply and split, seconds per call (built with " << backend_t::name << "):" << std::endl;
+    std::cout << "  log bits\t" << flint_backend::name << "\t" << gmp_backend::name;
+    #ifdef FLINT_HAVE_FFT_SMALL
+    std::cout << "\t" << fft_small_backend::name;
+    #endif
+    std::cout << std::endl;
+    for (uint64_t size = 10; size <= 24; size += 2) {
+        std::cout << "  " << size << "\t\t" << time_mul_split<flint_backend>(size, rand) << "\t" << time_mul_split<gmp_backend>(size, rand);
+        #ifdef FLINT_HAVE_FFT_SMALL
+        std::cout << "\t" << time_mul_split<fft_small_backend>(size, rand);
+        #endif
+        std::cout << std::endl;
+    }
+    flint_rand_clear(rand);
     return 0;
 }
 
@@ -0,0 +1,94 @@
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "blocks.h"
+#include "kernel.h"
+#include "metrics.h"
+#include "friendly_assert.h"
+
+// Between steps a block holds at most its width and a bit of overflow,
+// and a step multiplies it by a power of 3 of at most the same width,
+// which is 1.6 times as many bits. The top block also keeps the
+// overflow lazy carries leave on it, and the top segment's keeps
+// another block's worth before it grows.
+uint64_t block_capacity_bits(const data_t* data, int i) {
+    const uint64_t width = (uint64_t)1<<data->vars->block_size[i];
+    const uint64_t interval = data->config != nullptr ? data->config->carry_interval : 1;
+    const uint64_t held = i == 0 ? (interval+1)*width : width;
+    return held + 2*width + GMP_NUMB_BITS;
+}
+
+void blocks_reserve(data_t* data) {
+    vars_t* vars = data->vars;
+    const uint64_t lanes = vars->lanes;
+    for (size_t i = 0; i < vars->block_size.size(); i++) {
+        const uint64_t bits = block_capacity_bits(data, i);
+        const uint64_t limbs = (bits + GMP_NUMB_BITS-1)/GMP_NUMB_BITS;
+        for (fmpz* block : { &vars->stored[i*lanes], &vars->tmp[i*lanes] }) {
+            for (uint64_t j = 0; j < lanes; j++) {
+                if (!COEFF_IS_MPZ(block[j])) {
+                    continue;
+                }
+                mpz_ptr z = COEFF_TO_PTR(block[j]);
+                if (static_cast<uint64_t>(z->_mp_alloc) < limbs) {
+                    mpz_realloc2(z, bits);
+                    counter_count(data->metrics, blocks_reserved);
+                }
+            }
+        }
+    }
+}
+
+void blocks_check(data_t* data) {
+    #ifdef HYDRA_CHECK_BLOCKS
+    vars_t* vars = data->vars;
+    const uint64_t lanes = vars->lanes;
+    for (size_t i = 0; i < vars->block_size.size(); i++) {
+        const uint64_t bits = block_capacity_bits(data, i);
+        for (uint64_t j = 0; j < lanes; j++) {
+            if (fmpz_bits(&vars->stored[i*lanes + j]) > bits || fmpz_bits(&vars->tmp[i*lanes + j]) > bits) {
+                std::cerr << "Rank " << data->segment->world_rank << " block " << i << " lane " << j << " outgrew its " << bits << " bits." << std::endl;
+                friendly_assert(false, "Block overflow.");
+            }
+        }
+    }
+    #else
+    (void)data;
+    #endif
+}
+
+// Two blocks of 2^10 and 2^6 bits, one lane, without a config.
+void test_blocks() {
+    mp_limb_t single;
+    fmpz_t x; fmpz_init(x);
+    limb_span_t span = limbs_of(x, &single);
+    assert(span.size == 0);
+    fmpz_set_ui(x, 12345);
+    span = limbs_of(x, &single);
+    assert(span.size == 1 && span.limbs == &single && single == 12345);
+    fmpz_mul_2exp(x, x, 200);
+    span = limbs_of(x, &single);
+    assert(span.size == 4 && span.limbs[3] == 12345ull<<8);
+
+    data_t* data = lone_segment_init({10, 6}, 1, 0);
+    vars_t& vars = *data->vars;
+    const metrics_t* metrics = data->metrics;
+    assert(block_capacity_bits(data, 0) == 4*1024 + 64 && block_capacity_bits(data, 1) == 3*64 + 64);
+    fmpz_set(&vars.stored[0], x);
+    fmpz_set_ui(&vars.stored[1], 7);
+    blocks_reserve(data);
+    // the small one can't hold limbs
+    assert(metrics->counters.counter[blocks_reserved] == 1);
+    assert(COEFF_TO_PTR(vars.stored[0])->_mp_alloc == (4*1024 + 64)/64);
+    assert(fmpz_equal(&vars.stored[0], x) && fmpz_get_ui(&vars.stored[1]) == 7);
+    blocks_reserve(data);
+    assert(metrics->counters.counter[blocks_reserved] == 1);
+    blocks_check(data);
+    lone_segment_clear(data);
+    fmpz_clear(x);
+}
@@ -4,55 +4,43 @@
 #include <algorithm>
 #include <cstdint>
 #include <cassert>
+#include <vector>
 
 #include "common.h"
 
 #include "parse.h"
 #include "segment.h"
 #include "metrics.h"
-
-int main(int argc, char** argv) {
-    MPI_Init(NULL, NULL);
-
-    int world_size;
-    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
-
-    int world_rank;
-    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
-
-    std::cout << "Rank " << world_rank << " of " << world_size << " processes. Pid " << getpid() << "." << std::endl;
-
-    problem_t problem;
-    config_t config = {
-        .block_sizes_funnel = {},
-        .block_sizes_chain = {},
-        .block_sizes_used = {},
-        .global_block_max = 0,
-        .prune_bits = 0,
-        .checkpoint_interval = 0,
-    };
-
-    parse_args(&problem, &config, argc, argv);
-
-    segment_t segment = {
-        .world_size = world_size,
-        .world_rank = world_rank,
-        .is_base_segment = 0,
-        .is_top_segment = 0,
-    };
-
-    data_t* data = segment_init(&problem, &config, &segment);
-
+#include "communicate.h"
+#include "allocator.h"
+#include "checkpoint.h"
+#include "precompute.h"
+#include "dump.h"
+#include "helpers.h"
+#include "fibers.h"
+#include "friendly_assert.h"
+
+// The whole run of one segment, from its first step to the final print.
+void burn(data_t* data) {
+    const problem_t* problem = data->problem;
+    const config_t* config = data->config;
     // TODO: maybe allow specials at sub-steps?
-    int64_t next_special = config.global_block_max;
-    int64_t next_checkpoint = config.checkpoint_interval;
+    int64_t next_special = config->global_block_max;
     int64_t iterations = 0;
-    while (iterations < problem.iterations) {
-        if (config.checkpoint_interval && iterations >= next_checkpoint) {
+    if (config->restart) {
+        iterations = read_checkpoint(data);
+    } else if (!config->load_file.empty()) {
+        iterations = read_dump(data, config->load_file);
+    }
+    while (((int64_t)1<<next_special) < iterations) {
+        next_special += 1;
+    }
+    int64_t next_checkpoint = iterations + config->checkpoint_interval;
+    while (iterations < problem->iterations) {
+        if (config->checkpoint_interval && iterations >= next_checkpoint) {
             assert(iterations == next_checkpoint);
-            // TODO: do checkpoint
-            std::cout << "TODO: checkpoint" << std::endl;
-            next_checkpoint += config.checkpoint_interval;
+            write_checkpoint(data, iterations);
+            next_checkpoint += config->checkpoint_interval;
         }
         if (iterations >= (uint64_t)1<<next_special) {
             if (iterations != (uint64_t)1<<next_special) {
@@ -64,15 +52,19 @@ int main(int argc, char** argv) {
         }
         int64_t steps_to_special = ((uint64_t)1<<next_special) - iterations;
         int64_t steps = steps_to_special;
-        if (config.checkpoint_interval) {
+        if (config->checkpoint_interval) {
             int64_t steps_to_checkpoint = next_checkpoint - iterations;
             if (steps_to_checkpoint < steps) {
                 steps = steps_to_checkpoint;
             }
         }
+        segment_wake(data, iterations);
         int64_t performed = segment_burn(data, steps);
         iterations += performed;
     }
+    if (config->checkpoint_interval && iterations == next_checkpoint) {
+        write_checkpoint(data, iterations);
+    }
     segment_finalize(data);
 
     if (iterations == (uint64_t)1<<next_special) {
@@ -81,12 +73,103 @@ int main(int argc, char** argv) {
         // not great but whatever, should confuse someone
         print_special_2exp(data, -1);
     }
+    if (!config->dump_file.empty()) {
+        write_dump(data, config->dump_file, iterations);
+    }
+}
+
+// For fibers_spawn.
+void burn_fiber(void* data) {
+    burn((data_t*) data);
+}
+
+int main(int argc, char** argv) {
+    MPI_Init(NULL, NULL);
+
+    int world_size;
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    int world_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+    std::cout << "Rank " << world_rank << " of " << world_size << " processes. Pid " << getpid() << "." << std::endl;
+
+    problem_t problem;
+    config_t config = {
+        .block_sizes_funnel = {},
+        .block_sizes_chain = {},
+        .block_sizes_used = {},
+        .global_block_max = 0,
+        .prune_bits = 0,
+        .checkpoint_interval = 0,
+        .restart = false,
+        .pool_allocator = false,
+        .topology = "",
+        .cache_dir = "",
+        .carry_interval = 1,
+        .funnel_arity = {},
+        .dump_file = "",
+        .load_file = "",
+        .helpers = 0,
+        .help_from = 20,
+        .segments_per_rank = 1,
+        .dormant = false,
+        .hardware_counters = false,
+        .profile_funnel = false,
+    };
+
+    parse_args(&problem, &config, argc, argv);
+    if (config.pool_allocator) {
+        allocator_install();
+    }
 
-    timer_stop(data->metrics, active_time);
-    dump_metrics(data->metrics, segment.world_rank);
+    // helpers come after the chain
+    const int chain_size = world_size - static_cast<int>(config.helpers);
+    friendly_assert(chain_size > 0, "Not enough processes for the chain and its helpers.");
+    if (world_rank >= chain_size) {
+        helpers_serve(&config, world_rank, chain_size);
+        std::cout << "Helper " << world_rank << " done." << std::endl;
+        MPI_Finalize();
+        return 0;
+    }
 
-    std::cout << "Rank " << segment.world_rank << " done." << std::endl;
+    // every rank runs a few consecutive segments of the chain
+    const int count = static_cast<int>(config.segments_per_rank);
+    friendly_assert(count > 0, "Every rank needs at least one segment.");
+    std::vector<segment_t> segments(count);
+    for (int s = 0; s < count; s++) {
+        segments[s] = {
+            .world_size = chain_size*count,
+            .world_rank = world_rank*count + s,
+            .is_base_segment = 0,
+            .is_top_segment = 0,
+        };
+    }
 
+    std::vector<data_t*> group = segment_init(&problem, &config, segments.data(), count);
+    fibers_t* fibers = group[0]->transport->fibers;
+    if (fibers == nullptr) {
+        burn(group[0]);
+    } else {
+        for (data_t* data : group) {
+            fibers_spawn(fibers, burn_fiber, data);
+        }
+        fibers_run(fibers);
+    }
+
+    for (data_t* data : group) {
+        timer_stop(data->metrics, active_time);
+        allocator_collect(data->metrics);
+        dump_metrics(data->metrics, data->segment->world_rank);
+        hardware_close(data->metrics);
+        std::cout << "Rank " << data->segment->world_rank << " done." << std::endl;
+    }
+
+    helpers_finalize(group[count-1]);
+    // the top segment's powers are everyone's
+    precompute_finalize(group[count-1]);
+    for (data_t* data : group) {
+        transport_finalize(data);
+    }
     MPI_Finalize();
 }
-
@@ -0,0 +1,201 @@
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "checkpoint.h"
+#include "segment.h"
+#include "kernel.h"
+#include "communicate.h"
+#include "friendly_assert.h"
+
+// File layout, in native byte order:
+//  magic, iterations, initial, world size, rank, block count,
+//  then per block: global offset, log size, limb count, limbs.
+// Blocks are not normalized: a value can be wider than its block,
+// which is fine since only value*2^offset matters.
+const uint64_t checkpoint_magic = 0x314b434152445948; // "HYDRACK1"
+
+typedef struct checkpoint_header {
+    uint64_t magic;
+    int64_t iterations;
+    uint64_t initial;
+    uint64_t world_size;
+    uint64_t rank;
+    uint64_t blocks;
+} checkpoint_header_t;
+
+typedef struct checkpoint_block {
+    uint64_t global_offset;
+    uint64_t size;
+    uint64_t limbs;
+} checkpoint_block_t;
+
+std::string checkpoint_filename(int rank) {
+    std::string filename {"checkpoint"};
+    filename.append(std::to_string(rank));
+    filename.append(".bin");
+    return filename;
+}
+
+void write_checkpoint(data_t* data, int64_t iterations) {
+    segment_settle(data);
+    vars_t* vars = data->vars;
+    const std::string filename = checkpoint_filename(data->segment->world_rank);
+    // a crash while writing must not clobber the previous checkpoint
+    const std::string partial = filename + ".partial";
+    FILE* f = fopen(partial.c_str(), "wb");
+    friendly_assert(f != nullptr, "Could not open checkpoint file for writing.");
+    const checkpoint_header_t header = {
+        .magic = checkpoint_magic,
+        .iterations = iterations,
+        .initial = data->problem->initial,
+        .world_size = static_cast<uint64_t>(data->segment->world_size),
+        .rank = static_cast<uint64_t>(data->segment->world_rank),
+        .blocks = vars->stored.size(),
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (size_t j = 0; j < vars->stored.size(); j++) {
+        mp_limb_t single;
+        const limb_span_t span = limbs_of(&vars->stored[j], &single);
+        mp_srcptr limbs = span.limbs;
+        const uint64_t count = span.size;
+        const checkpoint_block_t block = {
+            .global_offset = vars->global_offset[j],
+            .size = vars->block_size[j],
+            .limbs = count,
+        };
+        ok = ok && fwrite(&block, sizeof(block), 1, f) == 1;
+        ok = ok && fwrite(limbs, sizeof(mp_limb_t), count, f) == count;
+    }
+    ok = fclose(f) == 0 && ok;
+    friendly_assert(ok, "Could not write checkpoint file.");
+    // Only a complete set replaces the previous one, or a restart could
+    // read files of two different checkpoints.
+    chain_barrier(data);
+    friendly_assert(rename(partial.c_str(), filename.c_str()) == 0, "Could not move checkpoint file into place.");
+    std::cout << "Rank " << data->segment->world_rank << " checkpointed at iteration " << iterations << "." << std::endl;
+}
+
+void add_bit_range(fmpz_t rop, const fmpz_t v, uint64_t offset, uint64_t start, uint64_t end) {
+    if (end <= offset || fmpz_is_zero(v)) {
+        return;
+    }
+    fmpz_t piece; fmpz_init(piece);
+    if (start >= offset) {
+        fmpz_fdiv_q_2exp(piece, v, start - offset);
+    } else {
+        fmpz_mul_2exp(piece, v, offset - start);
+    }
+    if (end != std::numeric_limits<uint64_t>::max()) {
+        fmpz_fdiv_r_2exp(piece, piece, end - start);
+    }
+    fmpz_add(rop, rop, piece);
+    fmpz_clear(piece);
+}
+
+int64_t read_checkpoint(data_t* data) {
+    vars_t* vars = data->vars;
+    const uint64_t unbounded = std::numeric_limits<uint64_t>::max();
+    const size_t count = vars->stored.size();
+    // new block j covers [start[j], end[j]), block 0 is the top
+    std::vector<uint64_t> start = vars->global_offset;
+    std::vector<uint64_t> end = {};
+    for (size_t j = 0; j < count; j++) {
+        end.push_back(start[j] + ((uint64_t)1<<vars->block_size[j]));
+        fmpz_zero(&vars->stored[j]);
+    }
+    if (data->segment->is_top_segment) {
+        end[0] = unbounded;
+    }
+    const uint64_t lowest = start[count-1];
+    const uint64_t highest = end[0];
+
+    int64_t iterations = -1;
+    uint64_t world_size = 1;
+    fmpz_t v; fmpz_init(v);
+    for (uint64_t rank = 0; rank < world_size; rank++) {
+        FILE* f = fopen(checkpoint_filename(rank).c_str(), "rb");
+        friendly_assert(f != nullptr, "Missing checkpoint file.");
+        checkpoint_header_t header;
+        friendly_assert(fread(&header, sizeof(header), 1, f) == 1 && header.magic == checkpoint_magic, "Not a checkpoint file.");
+        if (rank == 0) {
+            iterations = header.iterations;
+            world_size = header.world_size;
+            data->problem->initial = header.initial;
+        }
+        friendly_assert(header.iterations == iterations && header.world_size == world_size && header.rank == rank, "Checkpoint files are from different checkpoints.");
+        for (uint64_t b = 0; b < header.blocks; b++) {
+            checkpoint_block_t block;
+            friendly_assert(fread(&block, sizeof(block), 1, f) == 1, "Truncated checkpoint file.");
+            const uint64_t bits = block.limbs * GMP_NUMB_BITS;
+            if (block.limbs == 0 || block.global_offset >= highest || block.global_offset + bits <= lowest) {
+                fseek(f, block.limbs * sizeof(mp_limb_t), SEEK_CUR);
+                continue;
+            }
+            mpz_ptr z = _fmpz_promote(v);
+            mp_ptr limbs = mpz_limbs_write(z, block.limbs);
+            friendly_assert(fread(limbs, sizeof(mp_limb_t), block.limbs, f) == block.limbs, "Truncated checkpoint file.");
+            mpz_limbs_finish(z, block.limbs);
+            _fmpz_demote_val(v);
+            for (size_t j = 0; j < count; j++) {
+                add_bit_range(&vars->stored[j], v, block.global_offset, start[j], end[j]);
+            }
+        }
+        fclose(f);
+    }
+    fmpz_clear(v);
+    if (data->segment->is_top_segment) {
+        // the top block took everything above it
+        grow_top(data);
+    }
+    friendly_assert(iterations % ((int64_t)1<<data->config->global_block_max) == 0, "The checkpoint's iterations must be a multiple of the new config's largest block size.");
+    // Until everyone has read them, nobody may write the next checkpoint
+    // over the files.
+    chain_barrier(data);
+    std::cout << "Rank " << data->segment->world_rank << " restarted from iteration " << iterations << " of a " << world_size << " rank run." << std::endl;
+    return iterations;
+}
+
+void test_add_bit_range() {
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    // values wider than their blocks, as the chain leaves them
+    const std::vector<uint64_t> old_offsets = {0, 64, 100, 356};
+    const std::vector<uint64_t> new_offsets = {0, 30, 128, 200, 201};
+    fmpz_t total; fmpz_init(total);
+    fmpz_t resplit; fmpz_init(resplit);
+    fmpz_t v; fmpz_init(v);
+    std::vector<fmpz> values(old_offsets.size());
+    std::vector<fmpz> blocks(new_offsets.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        fmpz_init(&values[i]);
+        fmpz_randbits_unsigned(&values[i], rand, 50 + 100*i);
+        fmpz_mul_2exp(v, &values[i], old_offsets[i]);
+        fmpz_add(total, total, v);
+    }
+    for (size_t k = 0; k < blocks.size(); k++) {
+        fmpz_init(&blocks[k]);
+        const uint64_t end = k+1 < blocks.size() ? new_offsets[k+1] : std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < values.size(); i++) {
+            add_bit_range(&blocks[k], &values[i], old_offsets[i], new_offsets[k], end);
+        }
+        fmpz_mul_2exp(v, &blocks[k], new_offsets[k]);
+        fmpz_add(resplit, resplit, v);
+    }
+    assert(fmpz_equal(total, resplit));
+    for (size_t i = 0; i < values.size(); i++) {
+        fmpz_clear(&values[i]);
+    }
+    for (size_t k = 0; k < blocks.size(); k++) {
+        fmpz_clear(&blocks[k]);
+    }
+    fmpz_clear(total); fmpz_clear(resplit); fmpz_clear(v);
+    flint_rand_clear(rand);
+}
@@ -4,72 +4,477 @@
 #include <flint/fmpz.h>
 #include <iostream>
 #include <cassert>
+#include <algorithm>
+#include <climits>
+#include <vector>
 
 #include "common.h"
 #include "communicate.h"
 #include "segment.h"
 #include "metrics.h"
+#include "kernel.h"
+#include "friendly_assert.h"
 
-void send(metrics_t* metrics, int rank, int d, fmpz_t fx) {
+// Straight from the limbs of x, least significant first.
+void send(metrics_t* metrics, MPI_Comm comm, int rank, int d, fmpz_t fx) {
     timer_start(metrics, d > 0 ? waiting_send_left : waiting_send_right);
-    timer_start(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
-    _fmpz_promote_val(fx);
-    mpz_ptr x = COEFF_TO_PTR(*fx);
-    const size_t size = 8; // bytes per limb?
-    const size_t numb = GMP_LIMB_BITS; // nah, don't do nails
-    const size_t count = (mpz_sizeinbase(x, 2) + numb-1)/numb;
-    assert(count == mpz_size(x) || count == 1);
-    void* buf = malloc(count*size);
-    size_t countp = 0;
-    mpz_export(buf, &countp, 1, size, 0, 0, x);
-    assert(countp == 0 ? count == 1 : count == countp);
-    timer_stop(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
+    mp_limb_t single;
+    const limb_span_t span = limbs_of(fx, &single);
+    friendly_assert(span.size <= INT_MAX, "Payload too large for a single message.");
     timer_start(metrics, d > 0 ? waiting_send_left_mpi : waiting_send_right_mpi);
-    // TODO: named tag constants
-    const int error = MPI_Send(buf, countp, MPI_LONG, rank, 1, MPI_COMM_WORLD);
-    free(buf);
+    const int error = MPI_Send(span.limbs, static_cast<int>(span.size), MPI_UINT64_T, rank, tag_payload, comm);
     timer_stop(metrics, d > 0 ? waiting_send_left_mpi : waiting_send_right_mpi);
     assert(error == 0);
     timer_stop(metrics, d > 0 ? waiting_send_left : waiting_send_right);
 }
 
-void recv(metrics_t* metrics, int rank, int d, fmpz_t fx) {
+void recv(metrics_t* metrics, MPI_Comm comm, int rank, int d, fmpz_t fx) {
     timer_start(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
     timer_start(metrics, d > 0 ? waiting_recv_left_mpi : waiting_recv_right_mpi);
     MPI_Status status;
-    MPI_Probe(rank, 1, MPI_COMM_WORLD, &status);
+    MPI_Probe(rank, tag_payload, comm, &status);
     int count;
-    MPI_Get_count(&status, MPI_LONG, &count);
-    void* buf = malloc(count * sizeof(long));
-    MPI_Recv(buf, count, MPI_LONG, rank, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Get_count(&status, MPI_UINT64_T, &count);
+    mpz_ptr x = _fmpz_promote(fx);
+    mp_ptr dest = mpz_limbs_write(x, std::max(count, 1));
+    MPI_Recv(dest, count, MPI_UINT64_T, rank, tag_payload, comm, MPI_STATUS_IGNORE);
+    mpz_limbs_finish(x, count);
+    _fmpz_demote_val(fx);
     timer_stop(metrics, d > 0 ? waiting_recv_left_mpi : waiting_recv_right_mpi);
+    timer_stop(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
+}
+
+// Largest carries that can pass through an inbox, in limbs.
+// Carries going right are the low part of a product split at our
+// largest block. Carries going left are whatever overflows the
+// neighbor's largest block, which stays below twice its width.
+uint64_t carry_limbs(uint64_t log_bits, uint64_t factor) {
+    return ((factor<<log_bits) + GMP_NUMB_BITS-1)/GMP_NUMB_BITS + 1;
+}
+
+void open_inbox(MPI_Comm node, link_t* link, uint64_t limbs, uint64_t slots, MPI_Win* window) {
+    const MPI_Aint bytes = link->node_rank == MPI_UNDEFINED ? 0 : slots*limbs*sizeof(mp_limb_t);
+    MPI_Info info;
+    MPI_Info_create(&info);
+    // let each rank's inbox live in its own NUMA domain
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    MPI_Win_allocate_shared(bytes, sizeof(mp_limb_t), info, node, &link->inbox, window);
+    MPI_Info_free(&info);
+    link->inbox_window = *window;
+    link->inbox_slots = slots;
+    link->inbox_limbs = 0;
+    if (link->node_rank != MPI_UNDEFINED) {
+        // The neighbor splits the inbox into slots by the size it sees,
+        // which MPI may have rounded up.
+        MPI_Aint actual;
+        int disp_unit, self;
+        MPI_Comm_rank(node, &self);
+        MPI_Win_shared_query(*window, self, &actual, &disp_unit, &link->inbox);
+        link->inbox_limbs = actual/sizeof(mp_limb_t)/slots;
+    }
+    // Passive target for the whole run; MPI_Win_sync orders the
+    // accesses and the header message orders the ranks.
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *window);
+}
+
+void open_outbox(link_t* link, uint64_t slots, MPI_Win window) {
+    link->outbox_window = window;
+    link->outbox_slots = slots;
+    if (link->node_rank == MPI_UNDEFINED) {
+        return;
+    }
+    MPI_Aint bytes;
+    int disp_unit;
+    MPI_Win_shared_query(window, link->node_rank, &bytes, &disp_unit, &link->outbox);
+    link->outbox_limbs = bytes/sizeof(mp_limb_t)/slots;
+}
+
+int node_rank_of(MPI_Comm chain, MPI_Comm node, int rank) {
+    if (rank < 0) {
+        return MPI_UNDEFINED;
+    }
+    MPI_Group chain_group, node_group;
+    MPI_Comm_group(chain, &chain_group);
+    MPI_Comm_group(node, &node_group);
+    int node_rank;
+    MPI_Group_translate_ranks(chain_group, 1, &rank, node_group, &node_rank);
+    MPI_Group_free(&chain_group);
+    MPI_Group_free(&node_group);
+    return node_rank;
+}
+
+// A queue for carries from a segment of the same rank. The receiver
+// adds a slot onto its block and leaves it zero for the next turn.
+void open_queue(link_t* link, uint64_t slots, uint64_t lanes) {
+    link->inbox_slots = slots;
+    link->queue = (fmpz*) calloc(slots*lanes, sizeof(fmpz));
+}
+
+// Inboxes hold several carries, used in turn. The chain leaf sends its
+// low part before it waits for the carry from the right, and the carry
+// from the left is only read at the start of the next step. So a rank
+// only waits for its right neighbor every carry_interval steps, and
+// can write that many low parts ahead of it, plus the one in progress.
+// Carries going left are one apart at most: a rank only writes one
+// after receiving a low part its neighbor sent after reading the
+// carry before. Queues between segments of one rank take the same
+// number of slots.
+void transport_init(const std::vector<data_t*>& group) {
+    const int count = group.size();
+    data_t* bottom = group[0];
+    data_t* top = group[count-1];
+    MPI_Comm comm, node;
+    // Chain neighbors are adjacent in here, whatever order_chain picked.
+    MPI_Comm_split(MPI_COMM_WORLD, 0, bottom->segment->world_rank, &comm);
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, bottom->segment->world_rank, MPI_INFO_NULL, &node);
+    int rank;
+    MPI_Comm_rank(comm, &rank);
+    fibers_t* fibers = count > 1 ? fibers_create() : nullptr;
+    for (int s = 0; s < count; s++) {
+        transport_t* transport = (transport_t*) calloc(1, sizeof(transport_t));
+        group[s]->transport = transport;
+        fmpz_init(&transport->scratch);
+        transport->comm = comm;
+        transport->node = node;
+        transport->fibers = fibers;
+        transport->owns_mpi = s == 0;
+        transport->left = {};
+        transport->right = {};
+        transport->left.rank = -1;
+        transport->right.rank = -1;
+        transport->left.node_rank = MPI_UNDEFINED;
+        transport->right.node_rank = MPI_UNDEFINED;
+    }
+    // Lazy carries leave a block up to carry_interval steps' worth of
+    // overflow, which stays below that many block widths. The latency
+    // tool runs without a config.
+    const uint64_t interval = bottom->config != nullptr ? bottom->config->carry_interval : 1;
+    const uint64_t low_part_slots = interval + 1;
+    const uint64_t carry_slots = 2;
+    const uint64_t lanes = bottom->vars->lanes;
+    for (int s = 0; s+1 < count; s++) {
+        link_t* left = &group[s]->transport->left;
+        link_t* right = &group[s+1]->transport->right;
+        left->peer = right;
+        right->peer = left;
+        open_queue(left, low_part_slots, lanes);
+        open_queue(right, carry_slots, lanes);
+    }
+    // only the ends of the group have neighbors on other ranks
+    link_t* left = &top->transport->left;
+    link_t* right = &bottom->transport->right;
+    left->rank = top->segment->is_top_segment ? -1 : rank+1;
+    right->rank = bottom->segment->is_base_segment ? -1 : rank-1;
+    left->node_rank = node_rank_of(comm, node, left->rank);
+    right->node_rank = node_rank_of(comm, node, right->rank);
+    const std::vector<uint64_t>& top_blocks = top->vars->block_size;
+    const std::vector<uint64_t>& bottom_blocks = bottom->vars->block_size;
+    MPI_Win from_left, from_right;
+    // Every rank has to take part in both allocations.
+    open_inbox(node, left, lanes*carry_limbs(top_blocks[0], 1), low_part_slots, &from_left);
+    open_inbox(node, right, lanes*carry_limbs(bottom_blocks[bottom_blocks.size()-1], interval+1), carry_slots, &from_right);
+    open_outbox(left, carry_slots, from_right);
+    open_outbox(right, low_part_slots, from_left);
+    for (int s = 0; s < count; s++) {
+        group[s]->transport->from_left = from_left;
+        group[s]->transport->from_right = from_right;
+    }
+}
+
+void close_queue(link_t* link, uint64_t lanes) {
+    if (link->queue == nullptr) {
+        return;
+    }
+    for (uint64_t i = 0; i < link->inbox_slots*lanes; i++) {
+        fmpz_clear(&link->queue[i]);
+    }
+    free(link->queue);
+    link->queue = nullptr;
+}
+
+// The group's first segment goes first, the others only free their own.
+void transport_finalize(data_t* data) {
+    transport_t* transport = data->transport;
+    if (transport->owns_mpi) {
+        MPI_Win_unlock_all(transport->from_left);
+        MPI_Win_unlock_all(transport->from_right);
+        MPI_Win_free(&transport->from_left);
+        MPI_Win_free(&transport->from_right);
+        MPI_Comm_free(&transport->node);
+        MPI_Comm_free(&transport->comm);
+        if (transport->fibers != nullptr) {
+            fibers_destroy(transport->fibers);
+        }
+    }
+    close_queue(&transport->left, data->vars->lanes);
+    close_queue(&transport->right, data->vars->lanes);
+    fmpz_clear(&transport->scratch);
+    fmpz_clear(&transport->left.pending_carry);
+    fmpz_clear(&transport->right.pending_carry);
+    free(transport);
+    data->transport = nullptr;
+}
+
+static_assert(GMP_NUMB_BITS == 64, "carries are sent as MPI_UINT64_T limbs");
+
+// Copies the lanes of x back to back into buffer, each padded to the
+// widest one. Returns the packed limbs and sets their count.
+mp_srcptr pack_lanes(fmpz_t buffer, const fmpz* x, uint64_t lanes, uint64_t* limbs) {
+    uint64_t width = 0;
+    for (uint64_t j = 0; j < lanes; j++) {
+        assert(fmpz_sgn(&x[j]) >= 0);
+        width = std::max<uint64_t>(width, fmpz_size(&x[j]));
+    }
+    *limbs = width*lanes;
+    mpz_ptr packed = _fmpz_promote(buffer);
+    mp_ptr dest = mpz_limbs_write(packed, std::max<uint64_t>(*limbs, 1));
+    for (uint64_t j = 0; j < lanes; j++) {
+        mp_ptr lane = dest + j*width;
+        mp_limb_t single;
+        const limb_span_t span = limbs_of(&x[j], &single);
+        mpn_copyi(lane, span.limbs, span.size);
+        mpn_zero(lane + span.size, width - span.size);
+    }
+    mpz_limbs_finish(packed, *limbs);
+    return dest;
+}
+
+// Fills in the header and puts the payload wherever the header says
+// it is. Anything that is neither inline nor in the inbox is sent raw
+// afterwards, straight from the limbs of x (or of link->pending_carry
+// when lanes are packed), so those have to stay put until
+// link->pending completes.
+void post_carry(metrics_t* metrics, transport_t* transport, link_t* link, int d, fmpz* fx, uint64_t lanes) {
+    MPI_Comm comm = transport->comm;
+    timer_start(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
+    uint64_t limbs;
+    mp_srcptr source;
+    // a single limb always goes inline, so it's copied before this returns
+    mp_limb_t single;
+    if (lanes == 1) {
+        const limb_span_t span = limbs_of(fx, &single);
+        limbs = span.size;
+        source = span.limbs;
+    } else {
+        source = pack_lanes(&link->pending_carry, fx, lanes, &limbs);
+    }
+    carry_header_t* header = &link->pending_header;
+    header->limbs = limbs;
+    header->flags = 0;
+    uint64_t header_limbs = 0;
+    if (limbs <= carry_inline_limbs) {
+        mpn_copyi(header->inline_limbs, source, limbs);
+        header->flags = carry_inline;
+        header_limbs = limbs;
+        counter_count(metrics, limbs == 0 ? carries_sent_empty : carries_sent_inline);
+    } else if (limbs <= link->outbox_limbs) {
+        const uint64_t slot = link->outbox_turn % link->outbox_slots;
+        mpn_copyi(link->outbox + slot*link->outbox_limbs, source, limbs);
+        MPI_Win_sync(link->outbox_window);
+        header->flags = carry_in_inbox;
+    }
+    link->outbox_turn++;
+    timer_stop(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
+    const int header_bytes = static_cast<int>(2*sizeof(uint64_t) + header_limbs*sizeof(mp_limb_t));
+    MPI_Isend(header, header_bytes, MPI_BYTE, link->rank, tag_header, comm, &link->pending[0]);
+    link->pending[1] = MPI_REQUEST_NULL;
+    if (header->flags == 0) {
+        // MPI counts in int
+        friendly_assert(limbs <= INT_MAX, "Carry too large for a single message.");
+        MPI_Isend(source, static_cast<int>(limbs), MPI_UINT64_T, link->rank, tag_payload, comm, &link->pending[1]);
+    }
+}
+
+// Blocks, unless other segments of the rank can run in the meantime.
+void wait_requests(transport_t* transport, int count, MPI_Request* requests) {
+    if (transport->fibers == nullptr) {
+        MPI_Waitall(count, requests, MPI_STATUSES_IGNORE);
+        return;
+    }
+    int done = 0;
+    MPI_Testall(count, requests, &done, MPI_STATUSES_IGNORE);
+    while (!done) {
+        fibers_yield(transport->fibers);
+        MPI_Testall(count, requests, &done, MPI_STATUSES_IGNORE);
+    }
+}
+
+void wait_carry(metrics_t* metrics, transport_t* transport, link_t* link, int d) {
+    timer_start(metrics, d > 0 ? waiting_send_left_mpi : waiting_send_right_mpi);
+    wait_requests(transport, 2, link->pending);
+    timer_stop(metrics, d > 0 ? waiting_send_left_mpi : waiting_send_right_mpi);
+}
+
+// Swaps the lanes of x into the peer's next slot, once it has added
+// the carry that was there before.
+void send_local(metrics_t* metrics, transport_t* transport, link_t* link, int d, fmpz* x, uint64_t lanes) {
+    const link_t* peer = link->peer;
+    while (link->outbox_turn - peer->inbox_turn >= peer->inbox_slots) {
+        fibers_yield(transport->fibers);
+    }
+    timer_start(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
+    fmpz* slot = peer->queue + (link->outbox_turn % peer->inbox_slots)*lanes;
+    for (uint64_t j = 0; j < lanes; j++) {
+        fmpz_swap(&slot[j], &x[j]);
+    }
+    link->outbox_turn++;
+    timer_stop(metrics, d > 0 ? waiting_send_left_copy : waiting_send_right_copy);
+}
+
+bool recv_local(metrics_t* metrics, transport_t* transport, link_t* link, int d, fmpz* acc, uint64_t lanes) {
+    while (link->peer->outbox_turn == link->inbox_turn) {
+        fibers_yield(transport->fibers);
+    }
     timer_start(metrics, d > 0 ? waiting_recv_left_copy : waiting_recv_right_copy);
-    const size_t size = 8;
-    _fmpz_promote(fx);
-    mpz_ptr x = COEFF_TO_PTR(*fx);
-    mpz_import(x, static_cast<size_t>(count), 1, size, 0, 0, buf);
-    free(buf);
+    fmpz* slot = link->queue + (link->inbox_turn % link->inbox_slots)*lanes;
+    bool nonempty = false;
+    for (uint64_t j = 0; j < lanes; j++) {
+        nonempty |= !fmpz_is_zero(&slot[j]);
+        fmpz_add(&acc[j], &acc[j], &slot[j]);
+        fmpz_zero(&slot[j]);
+    }
+    link->inbox_turn++;
     timer_stop(metrics, d > 0 ? waiting_recv_left_copy : waiting_recv_right_copy);
+    return nonempty;
+}
+
+void send_carry(metrics_t* metrics, transport_t* transport, link_t* link, int d, fmpz* fx, uint64_t lanes) {
+    timer_start(metrics, d > 0 ? waiting_send_left : waiting_send_right);
+    if (link->peer != nullptr) {
+        send_local(metrics, transport, link, d, fx, lanes);
+    } else {
+        post_carry(metrics, transport, link, d, fx, lanes);
+        wait_carry(metrics, transport, link, d);
+        _fmpz_demote_val(fx);
+    }
+    timer_stop(metrics, d > 0 ? waiting_send_left : waiting_send_right);
+}
+
+// A raw payload lands in the transport's scratch, which stays promoted
+// so that its limbs get reused from one carry to the next.
+bool recv_carry_add(metrics_t* metrics, transport_t* transport, link_t* link, int d, fmpz* acc, uint64_t lanes) {
+    if (link->peer != nullptr) {
+        timer_start(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
+        const bool nonempty = recv_local(metrics, transport, link, d, acc, lanes);
+        timer_stop(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
+        return nonempty;
+    }
+    MPI_Comm comm = transport->comm;
+    timer_start(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
+    timer_start(metrics, d > 0 ? waiting_recv_left_mpi : waiting_recv_right_mpi);
+    carry_header_t header;
+    MPI_Request request;
+    MPI_Irecv(&header, sizeof(header), MPI_BYTE, link->rank, tag_header, comm, &request);
+    wait_requests(transport, 1, &request);
+    const uint64_t limbs = header.limbs;
+    mp_srcptr source = header.inline_limbs;
+    if (header.flags == 0) {
+        mpz_ptr landing = _fmpz_promote(&transport->scratch);
+        mp_ptr dest = mpz_limbs_write(landing, limbs);
+        MPI_Irecv(dest, static_cast<int>(limbs), MPI_UINT64_T, link->rank, tag_payload, comm, &request);
+        wait_requests(transport, 1, &request);
+        mpz_limbs_finish(landing, limbs);
+        source = dest;
+    }
+    timer_stop(metrics, d > 0 ? waiting_recv_left_mpi : waiting_recv_right_mpi);
+    if (limbs > 0) {
+        timer_start(metrics, d > 0 ? waiting_recv_left_copy : waiting_recv_right_copy);
+        if (header.flags & carry_in_inbox) {
+            MPI_Win_sync(link->inbox_window);
+            source = link->inbox + (link->inbox_turn % link->inbox_slots)*link->inbox_limbs;
+        }
+        const uint64_t width = limbs/lanes;
+        assert(width*lanes == limbs);
+        for (uint64_t j = 0; j < lanes; j++) {
+            mpz_t carry;
+            mpz_roinit_n(carry, source + j*width, width);
+            mpz_ptr x = _fmpz_promote_val(&acc[j]);
+            mpz_add(x, x, carry);
+            _fmpz_demote_val(&acc[j]);
+        }
+        timer_stop(metrics, d > 0 ? waiting_recv_left_copy : waiting_recv_right_copy);
+    }
+    link->inbox_turn++;
     timer_stop(metrics, d > 0 ? waiting_recv_left : waiting_recv_right);
+    return limbs > 0;
 }
 
-void sendLeft(data_t* data, fmpz_t x) {
-    send(data->metrics, data->segment->world_rank+1, +1, x);
+void sendLeft(data_t* data, fmpz* x) {
+    send_carry(data->metrics, data->transport, &data->transport->left, +1, x, data->vars->lanes);
 }
-void receiveLeft(data_t* data, fmpz_t x) {
-    recv(data->metrics, data->segment->world_rank+1, +1, x);
+bool receiveLeftAdd(data_t* data, fmpz* x) {
+    return recv_carry_add(data->metrics, data->transport, &data->transport->left, +1, x, data->vars->lanes);
 }
-void sendRight(data_t* data, fmpz_t x) {
-    send(data->metrics, data->segment->world_rank-1, -1, x);
+void startSendLeft(data_t* data, fmpz* x) {
+    link_t* left = &data->transport->left;
+    assert(!left->sending);
+    const uint64_t lanes = data->vars->lanes;
+    // nothing to wait for later
+    if (left->peer != nullptr) {
+        sendLeft(data, x);
+        return;
+    }
+    // several lanes get packed into pending_carry anyway
+    fmpz* carry = x;
+    if (lanes == 1) {
+        fmpz_swap(&left->pending_carry, x);
+        carry = &left->pending_carry;
+    }
+    timer_start(data->metrics, waiting_send_left);
+    post_carry(data->metrics, data->transport, left, +1, carry, lanes);
+    timer_stop(data->metrics, waiting_send_left);
+    left->sending = true;
 }
-void receiveRight(data_t* data, fmpz_t x) {
-    recv(data->metrics, data->segment->world_rank-1, -1, x);
+void finishSendLeft(data_t* data) {
+    link_t* left = &data->transport->left;
+    if (!left->sending) {
+        return;
+    }
+    timer_start(data->metrics, waiting_send_left);
+    wait_carry(data->metrics, data->transport, left, +1);
+    timer_stop(data->metrics, waiting_send_left);
+    left->sending = false;
+}
+bool carry_due(data_t* data, link_t* link) {
+    link->steps++;
+    if (link->steps < data->config->carry_interval) {
+        return false;
+    }
+    link->steps = 0;
+    return true;
+}
+void sendRight(data_t* data, fmpz* x) {
+    send_carry(data->metrics, data->transport, &data->transport->right, -1, x, data->vars->lanes);
+}
+bool receiveRightAdd(data_t* data, fmpz* x) {
+    return recv_carry_add(data->metrics, data->transport, &data->transport->right, -1, x, data->vars->lanes);
 }
 
 
+void chain_barrier(data_t* data) {
+    transport_t* transport = data->transport;
+    fmpz_t none; fmpz_init(none);
+    if (transport->fibers != nullptr) {
+        fibers_sum(transport->fibers, none, transport->owns_mpi);
+    }
+    if (transport->owns_mpi) {
+        MPI_Request request;
+        MPI_Ibarrier(transport->comm, &request);
+        wait_requests(transport, 1, &request);
+    }
+    // the others wait in here until the first one is through
+    if (transport->fibers != nullptr) {
+        fibers_sum(transport->fibers, none, transport->owns_mpi);
+    }
+    fmpz_clear(none);
+}
+
 void gather(data_t* data, fmpz_t fitem, fmpz* buffer, int root) {
     timer_start(data->metrics, gather_communication);
-    const int world_size = data->segment->world_size;
+    // one item per rank, however many segments it runs
+    int world_size, rank;
+    MPI_Comm_size(data->transport->comm, &world_size);
+    MPI_Comm_rank(data->transport->comm, &rank);
     // Despite our willingness to do it, GMP, FLINT, and MPI all
     // count object sizes in `int`- the signed 32 bit integer.
     // By specifying `long`s we can get roughly 2^38 sized messages,
@@ -88,17 +493,17 @@ void gather(data_t* data, fmpz_t fitem, fmpz* buffer, int root) {
     mpz_export(sendbuf, &sent_limb_count, order, limb_size, 0, 0, item);
     assert(send_limb_count == sent_limb_count);
     int send_limb_count_int = static_cast<int>(send_limb_count);
-    MPI_Gather(&send_limb_count_int, 1, MPI_INT, sizesbuf, 1, MPI_INT, root, MPI_COMM_WORLD);
+    MPI_Gather(&send_limb_count_int, 1, MPI_INT, sizesbuf, 1, MPI_INT, root, data->transport->comm);
     uint64_t* limbs = nullptr;
-    if (data->segment->world_rank == root) {
+    if (rank == root) {
         displs[0] = 0;
         for (int i = 1; i < world_size; i++) {
             displs[i] = displs[i-1] + sizesbuf[i-1];
         }
         limbs = (uint64_t*) calloc(displs[world_size-1] + sizesbuf[world_size-1], sizeof(uint64_t));
     }
-    MPI_Gatherv(sendbuf, send_limb_count_int, MPI_LONG, limbs, sizesbuf, displs, MPI_LONG, root, MPI_COMM_WORLD);
-    if (data->segment->world_rank == root) {
+    MPI_Gatherv(sendbuf, send_limb_count_int, MPI_LONG, limbs, sizesbuf, displs, MPI_LONG, root, data->transport->comm);
+    if (rank == root) {
         for (int i = 0; i < world_size; i++) {
             fmpz* rop = &buffer[i];
             _fmpz_promote(rop);
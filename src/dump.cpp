@@ -0,0 +1,193 @@
+#include <mpi.h>
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "dump.h"
+#include "communicate.h"
+#include "segment.h"
+#include "kernel.h"
+#include "friendly_assert.h"
+
+// File layout, in native byte order:
+//  magic, iterations, initial, limb count,
+//  then the limbs of the integer, least significant first.
+// Limb k holds bits [64k, 64k+64), so a block starts at limb
+// global_offset/64. Blocks of at least 2^6 bits keep every offset on a
+// limb boundary, constrain_config makes sure of that.
+const uint64_t dump_magic = 0x3150444152445948; // "HYDRADP1"
+
+typedef struct dump_header {
+    uint64_t magic;
+    int64_t iterations;
+    uint64_t initial;
+    uint64_t limbs;
+} dump_header_t;
+
+static_assert(GMP_NUMB_BITS == 64, "dumps are read and written as MPI_UINT64_T limbs");
+
+// Bottom block up, and then on to the left neighbor's bottom block,
+// which sits right above our top block. Ranks wait for each other in
+// chain order, but only for one carry each.
+void resolve_carries(data_t* data) {
+    segment_settle(data);
+    vars_t* vars = data->vars;
+    assert(vars->lanes == 1);
+    const int count = vars->stored.size();
+    if (!data->segment->is_base_segment) {
+        receiveRightAdd(data, &vars->stored[count-1]);
+    }
+    fmpz_t carry; fmpz_init(carry);
+    for (int j = count-1; j > 0; j--) {
+        const uint64_t width = (uint64_t)1<<vars->block_size[j];
+        fmpz_fdiv_q_2exp(carry, &vars->stored[j], width);
+        fmpz_fdiv_r_2exp(&vars->stored[j], &vars->stored[j], width);
+        fmpz_add(&vars->stored[j-1], &vars->stored[j-1], carry);
+    }
+    // the top of the integer has nowhere to go
+    if (!data->segment->is_top_segment) {
+        const uint64_t width = (uint64_t)1<<vars->block_size[0];
+        fmpz_fdiv_q_2exp(carry, &vars->stored[0], width);
+        fmpz_fdiv_r_2exp(&vars->stored[0], &vars->stored[0], width);
+        sendLeft(data, carry);
+    }
+    fmpz_clear(carry);
+}
+
+// Describes the rank's blocks for one collective access: where their
+// limbs are in memory, and where they go in the file. File views need
+// ascending displacements, so the blocks are listed bottom up.
+void block_types(const std::vector<int>& lengths, const std::vector<MPI_Aint>& memory, const std::vector<MPI_Aint>& file, MPI_Datatype* memory_type, MPI_Datatype* file_type) {
+    const int count = lengths.size();
+    MPI_Type_create_hindexed(count, lengths.data(), memory.data(), MPI_UINT64_T, memory_type);
+    MPI_Type_create_hindexed(count, lengths.data(), file.data(), MPI_UINT64_T, file_type);
+    MPI_Type_commit(memory_type);
+    MPI_Type_commit(file_type);
+}
+
+void write_dump(data_t* data, const std::string& filename, int64_t iterations) {
+    resolve_carries(data);
+    vars_t* vars = data->vars;
+    const int count = vars->stored.size();
+    // small values live inside their fmpz, give them an address
+    std::vector<mp_limb_t> singles(count);
+    std::vector<int> lengths = {};
+    std::vector<MPI_Aint> memory = {};
+    std::vector<MPI_Aint> file = {};
+    uint64_t end = 0; // past our highest limb
+    for (int j = count-1; j >= 0; j--) {
+        const limb_span_t span = limbs_of(&vars->stored[j], &singles[j]);
+        mp_srcptr limbs = span.limbs;
+        const uint64_t n = span.size;
+        friendly_assert(n <= INT_MAX, "Block too large for a single dump.");
+        const uint64_t first = vars->global_offset[j]/GMP_NUMB_BITS;
+        MPI_Aint address;
+        MPI_Get_address(limbs, &address);
+        lengths.push_back(static_cast<int>(n));
+        memory.push_back(address);
+        file.push_back(first*sizeof(mp_limb_t));
+        // zero blocks, like those of dormant segments, write nothing
+        if (n > 0) {
+            end = std::max(end, first + n);
+        }
+    }
+    MPI_Comm comm = data->transport->comm;
+    uint64_t total = 0;
+    MPI_Allreduce(&end, &total, 1, MPI_UINT64_T, MPI_MAX, comm);
+
+    MPI_File fh;
+    friendly_assert(MPI_File_open(comm, filename.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS, "Could not open dump file for writing.");
+    // an older, longer dump would leave its tail behind
+    MPI_File_set_size(fh, 0);
+    int error = MPI_SUCCESS;
+    if (data->segment->is_base_segment) {
+        const dump_header_t header = {
+            .magic = dump_magic,
+            .iterations = iterations,
+            .initial = data->problem->initial,
+            .limbs = total,
+        };
+        error = MPI_File_write_at(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    }
+    MPI_Datatype memory_type, file_type;
+    block_types(lengths, memory, file, &memory_type, &file_type);
+    MPI_File_set_view(fh, sizeof(dump_header_t), MPI_UINT64_T, file_type, "native", MPI_INFO_NULL);
+    const int write_error = MPI_File_write_all(fh, MPI_BOTTOM, 1, memory_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&memory_type);
+    MPI_Type_free(&file_type);
+    friendly_assert(error == MPI_SUCCESS && write_error == MPI_SUCCESS, "Could not write dump file.");
+    if (data->segment->is_base_segment) {
+        std::cout << "Dumped " << total << " limbs at iteration " << iterations << " to " << filename << "." << std::endl;
+    }
+}
+
+int64_t read_dump(data_t* data, const std::string& filename) {
+    vars_t* vars = data->vars;
+    assert(vars->lanes == 1);
+    MPI_Comm comm = data->transport->comm;
+    MPI_File fh;
+    friendly_assert(MPI_File_open(comm, filename.c_str(), MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) == MPI_SUCCESS, "Could not open dump file.");
+    dump_header_t header = {};
+    MPI_File_read_at_all(fh, 0, &header, sizeof(header), MPI_BYTE, MPI_STATUS_IGNORE);
+    friendly_assert(header.magic == dump_magic, "Not a dump file.");
+    MPI_Offset bytes = 0;
+    MPI_File_get_size(fh, &bytes);
+    friendly_assert(static_cast<uint64_t>(bytes) >= sizeof(header) + header.limbs*sizeof(mp_limb_t), "Truncated dump file.");
+
+    const int count = vars->stored.size();
+    std::vector<int> lengths = {};
+    std::vector<MPI_Aint> memory = {};
+    std::vector<MPI_Aint> file = {};
+    mp_limb_t nowhere;
+    for (int j = count-1; j >= 0; j--) {
+        // the top block takes everything above it
+        const uint64_t first = std::min(vars->global_offset[j]/GMP_NUMB_BITS, header.limbs);
+        uint64_t last = std::min(first + ((uint64_t)1<<vars->block_size[j])/GMP_NUMB_BITS, header.limbs);
+        if (j == 0 && data->segment->is_top_segment) {
+            last = header.limbs;
+        }
+        const uint64_t n = last - first;
+        friendly_assert(n <= INT_MAX, "Block too large for a single dump.");
+        mp_ptr dest = &nowhere;
+        if (n > 0) {
+            dest = mpz_limbs_write(_fmpz_promote(&vars->stored[j]), n);
+        }
+        MPI_Aint address;
+        MPI_Get_address(dest, &address);
+        lengths.push_back(static_cast<int>(n));
+        memory.push_back(address);
+        file.push_back(first*sizeof(mp_limb_t));
+    }
+    MPI_Datatype memory_type, file_type;
+    block_types(lengths, memory, file, &memory_type, &file_type);
+    MPI_File_set_view(fh, sizeof(dump_header_t), MPI_UINT64_T, file_type, "native", MPI_INFO_NULL);
+    const int error = MPI_File_read_all(fh, MPI_BOTTOM, 1, memory_type, MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    MPI_Type_free(&memory_type);
+    MPI_Type_free(&file_type);
+    friendly_assert(error == MPI_SUCCESS, "Could not read dump file.");
+    for (int j = count-1, k = 0; j >= 0; j--, k++) {
+        fmpz* x = &vars->stored[j];
+        if (lengths[k] == 0) {
+            fmpz_zero(x);
+            continue;
+        }
+        mpz_limbs_finish(COEFF_TO_PTR(*x), lengths[k]);
+        _fmpz_demote_val(x);
+    }
+    if (data->segment->is_top_segment) {
+        grow_top(data);
+    }
+    data->problem->initial = header.initial;
+    friendly_assert(header.iterations % ((int64_t)1<<data->config->global_block_max) == 0, "The dump's iterations must be a multiple of the config's largest block size.");
+    std::cout << "Rank " << data->segment->world_rank << " loaded iteration " << header.iterations << " from " << filename << "." << std::endl;
+    return header.iterations;
+}
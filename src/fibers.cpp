@@ -0,0 +1,152 @@
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include "fibers.h"
+#include "friendly_assert.h"
+
+// GMP keeps its temporaries on the stack, so be generous. Untouched
+// pages of the mapping cost nothing.
+const size_t fiber_stack_bytes = (size_t)64<<20;
+
+// makecontext only passes ints along.
+static void fiber_entry(unsigned int high, unsigned int low) {
+    fiber_t* fiber = (fiber_t*) (((uintptr_t)high << 32) | (uintptr_t)low);
+    fiber->run(fiber->arg);
+    fiber->done = true;
+    // returning resumes uc_link, the scheduler
+}
+
+fibers_t* fibers_create() {
+    fibers_t* fibers = new fibers_t;
+    fibers->list = {};
+    fibers->current = 0;
+    fmpz_init(&fibers->sum);
+    fibers->arrived = 0;
+    fibers->generation = 0;
+    return fibers;
+}
+
+void fibers_spawn(fibers_t* fibers, void (*run)(void*), void* arg) {
+    fiber_t* fiber = (fiber_t*) calloc(1, sizeof(fiber_t));
+    fiber->stack_bytes = fiber_stack_bytes;
+    fiber->stack = mmap(nullptr, fiber->stack_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+    friendly_assert(fiber->stack != MAP_FAILED, "Could not map a fiber stack.");
+    fiber->run = run;
+    fiber->arg = arg;
+    fiber->done = false;
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack;
+    fiber->context.uc_stack.ss_size = fiber->stack_bytes;
+    fiber->context.uc_link = &fibers->scheduler;
+    const uintptr_t address = (uintptr_t)fiber;
+    makecontext(&fiber->context, (void (*)()) fiber_entry, 2, (unsigned int)(address >> 32), (unsigned int)(address & 0xffffffff));
+    fibers->list.push_back(fiber);
+}
+
+void fibers_run(fibers_t* fibers) {
+    size_t remaining = fibers->list.size();
+    while (remaining > 0) {
+        for (size_t i = 0; i < fibers->list.size(); i++) {
+            fiber_t* fiber = fibers->list[i];
+            if (fiber->done) {
+                continue;
+            }
+            fibers->current = i;
+            swapcontext(&fibers->scheduler, &fiber->context);
+            remaining -= fiber->done;
+        }
+    }
+}
+
+void fibers_yield(fibers_t* fibers) {
+    swapcontext(&fibers->list[fibers->current]->context, &fibers->scheduler);
+}
+
+void fibers_destroy(fibers_t* fibers) {
+    for (fiber_t* fiber : fibers->list) {
+        assert(fiber->done);
+        munmap(fiber->stack, fiber->stack_bytes);
+        free(fiber);
+    }
+    fmpz_clear(&fibers->sum);
+    delete fibers;
+}
+
+// Everyone else has to wait for the first one to take the sum, or a
+// fast fiber could add its next x into this one.
+bool fibers_sum(fibers_t* fibers, fmpz_t x, bool first) {
+    const uint64_t others = fibers->list.size() - 1;
+    if (!first) {
+        const uint64_t generation = fibers->generation;
+        fmpz_add(&fibers->sum, &fibers->sum, x);
+        fibers->arrived++;
+        while (fibers->generation == generation) {
+            fibers_yield(fibers);
+        }
+        return false;
+    }
+    while (fibers->arrived < others) {
+        fibers_yield(fibers);
+    }
+    fmpz_add(x, x, &fibers->sum);
+    fmpz_zero(&fibers->sum);
+    fibers->arrived = 0;
+    fibers->generation++;
+    return true;
+}
+
+typedef struct test_fiber {
+    fibers_t* fibers;
+    uint64_t index;
+    std::vector<uint64_t>* trace;
+    uint64_t* mailbox;
+} test_fiber_t;
+
+// Fiber 1 waits for fiber 0's message, so the two have to interleave.
+static void test_fiber_run(void* arg) {
+    test_fiber_t* t = (test_fiber_t*) arg;
+    for (uint64_t round = 0; round < 3; round++) {
+        if (t->index == 0) {
+            *t->mailbox = round + 1;
+        } else {
+            while (*t->mailbox != round + 1) {
+                fibers_yield(t->fibers);
+            }
+        }
+        t->trace->push_back(t->index);
+        fmpz_t x; fmpz_init_set_ui(x, t->index + 1);
+        const bool first = fibers_sum(t->fibers, x, t->index == 0);
+        assert(first == (t->index == 0));
+        assert(!first || fmpz_get_ui(x) == 6);
+        fmpz_clear(x);
+    }
+}
+
+void test_fibers() {
+    fibers_t* fibers = fibers_create();
+    std::vector<uint64_t> trace = {};
+    uint64_t mailbox = 0;
+    std::vector<test_fiber_t> tests(3);
+    for (uint64_t i = 0; i < 3; i++) {
+        tests[i] = { .fibers = fibers, .index = i, .trace = &trace, .mailbox = &mailbox };
+    }
+    // the waiting one first
+    for (uint64_t i : { 1, 0, 2 }) {
+        fibers_spawn(fibers, test_fiber_run, &tests[i]);
+    }
+    fibers_run(fibers);
+    assert(trace.size() == 9);
+    for (uint64_t round = 0; round < 3; round++) {
+        // nobody gets ahead of a sum
+        std::vector<uint64_t> seen(trace.begin() + 3*round, trace.begin() + 3*round + 3);
+        std::sort(seen.begin(), seen.end());
+        assert(seen == std::vector<uint64_t>({ 0, 1, 2 }));
+    }
+    fibers_destroy(fibers);
+}
@@ -0,0 +1,285 @@
+#include <mpi.h>
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+#include "helpers.h"
+#include "communicate.h"
+#include "kernel.h"
+#include "precompute.h"
+#include "segment.h"
+#include "metrics.h"
+#include "friendly_assert.h"
+
+// Sent in place of an exponent when the top segment is done.
+const uint64_t helpers_done = UINT64_MAX;
+
+uint64_t pow3(int d) {
+    uint64_t p = 1;
+    for (int i = 0; i < d; i++) {
+        p *= 3;
+    }
+    return p;
+}
+
+int helper_depth(uint64_t helpers) {
+    int depth = 0;
+    uint64_t group = 1;
+    while (group < helpers + 1) {
+        group *= 3;
+        depth++;
+    }
+    return helpers > 0 && group == helpers + 1 ? depth : -1;
+}
+
+// About half the bits of a piece of the power, on a limb boundary.
+uint64_t split_bits(const fmpz_t p) {
+    const uint64_t half = (fmpz_bits(p) + 1)/2;
+    return (half + GMP_NUMB_BITS-1)/GMP_NUMB_BITS*GMP_NUMB_BITS;
+}
+
+// Pieces of x in group order, the top level being the most significant
+// digit in base 3, and the split points in preorder.
+void karatsuba_pieces(const fmpz_t x, const fmpz_t p, int depth, std::vector<fmpz>* pieces, std::vector<uint64_t>* splits) {
+    if (depth == 0) {
+        fmpz a; fmpz_init_set(&a, x);
+        pieces->push_back(a);
+        return;
+    }
+    const uint64_t h = split_bits(p);
+    splits->push_back(h);
+    fmpz_t xs[3], ps[3];
+    for (int k = 0; k < 3; k++) {
+        fmpz_init(xs[k]); fmpz_init(ps[k]);
+    }
+    fmpz_fdiv_r_2exp(xs[0], x, h);
+    fmpz_fdiv_q_2exp(xs[1], x, h);
+    fmpz_add(xs[2], xs[0], xs[1]);
+    fmpz_fdiv_r_2exp(ps[0], p, h);
+    fmpz_fdiv_q_2exp(ps[1], p, h);
+    fmpz_add(ps[2], ps[0], ps[1]);
+    for (int k = 0; k < 3; k++) {
+        karatsuba_pieces(xs[k], ps[k], depth-1, pieces, splits);
+        fmpz_clear(xs[k]); fmpz_clear(ps[k]);
+    }
+}
+
+// The piece of p that rank k of the group multiplies by.
+void karatsuba_piece(fmpz_t rop, const fmpz_t p, int depth, uint64_t k) {
+    fmpz_t high; fmpz_init(high);
+    fmpz_set(rop, p);
+    for (int level = depth-1; level >= 0; level--) {
+        const uint64_t digit = k / pow3(level) % 3;
+        const uint64_t h = split_bits(rop);
+        fmpz_fdiv_q_2exp(high, rop, h);
+        fmpz_fdiv_r_2exp(rop, rop, h);
+        if (digit == 1) {
+            fmpz_swap(rop, high);
+        } else if (digit == 2) {
+            fmpz_add(rop, rop, high);
+        }
+    }
+    fmpz_clear(high);
+}
+
+// low*low + (sum*sum - low*low - high*high)*2^h + high*high*2^2h
+// at every level, consuming the splits in the same preorder.
+void karatsuba_combine(fmpz_t rop, const fmpz* products, const uint64_t** splits, int depth) {
+    if (depth == 0) {
+        fmpz_set(rop, products);
+        return;
+    }
+    const uint64_t h = *(*splits)++;
+    const uint64_t width = pow3(depth-1);
+    fmpz_t low, high, sum;
+    fmpz_init(low); fmpz_init(high); fmpz_init(sum);
+    karatsuba_combine(low, products, splits, depth-1);
+    karatsuba_combine(high, products + width, splits, depth-1);
+    karatsuba_combine(sum, products + 2*width, splits, depth-1);
+    fmpz_sub(sum, sum, low);
+    fmpz_sub(sum, sum, high);
+    fmpz_mul_2exp(sum, sum, h);
+    fmpz_mul_2exp(high, high, 2*h);
+    fmpz_add(rop, low, sum);
+    fmpz_add(rop, rop, high);
+    fmpz_clear(low); fmpz_clear(high); fmpz_clear(sum);
+}
+
+// limbs_of, counted the way MPI does.
+static mp_srcptr piece_limbs(const fmpz_t f, mp_limb_t* single, int* n) {
+    const limb_span_t span = limbs_of(f, single);
+    friendly_assert(span.size <= INT_MAX, "Piece too large for a single message.");
+    *n = static_cast<int>(span.size);
+    return span.limbs;
+}
+
+// Between the top segment and its helpers, in MPI_COMM_WORLD, see
+// helped_mul.
+void recv_limbs(fmpz_t rop, int rank, int tag) {
+    MPI_Status status;
+    MPI_Probe(rank, tag, MPI_COMM_WORLD, &status);
+    int count;
+    MPI_Get_count(&status, MPI_UINT64_T, &count);
+    mpz_ptr z = _fmpz_promote(rop);
+    mp_ptr dest = mpz_limbs_write(z, std::max(count, 1));
+    MPI_Recv(dest, count, MPI_UINT64_T, rank, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    mpz_limbs_finish(z, count);
+    _fmpz_demote_val(rop);
+}
+
+void send_limbs(const fmpz_t x, int rank, int tag) {
+    mp_limb_t single;
+    int n;
+    mp_srcptr limbs = piece_limbs(x, &single, &n);
+    MPI_Send(limbs, n, MPI_UINT64_T, rank, tag, MPI_COMM_WORLD);
+}
+
+// Helpers come right after the chain in MPI_COMM_WORLD, and --topology
+// is not allowed with them, so the top segment is the rank before.
+void helpers_serve(config_t* config, int world_rank, int chain_size) {
+    // the collectives chain ranks make on MPI_COMM_WORLD while they set
+    // up, in segment_init and transport_init
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Comm none;
+    MPI_Comm_split(MPI_COMM_WORLD, MPI_UNDEFINED, world_rank, &none);
+    flint_set_num_threads(4);
+
+    const int top = chain_size - 1;
+    const int depth = helper_depth(config->helpers);
+    const uint64_t k = world_rank - chain_size + 1;
+    uint64_t largest = 0;
+    for (const auto& lists : { config->block_sizes_funnel, config->block_sizes_chain }) {
+        for (const auto& list : lists) {
+            for (const uint64_t size : list) {
+                largest = std::max(largest, size);
+            }
+        }
+    }
+    std::vector<fmpz> p3;
+    precompute_t* pre = precompute_start(&p3, largest+1, config->cache_dir);
+    // our piece of each power, cut on first use
+    std::vector<fmpz> pieces(largest+1, 0);
+    std::vector<bool> cut(largest+1, false);
+    fmpz_t x, product;
+    fmpz_init(x); fmpz_init(product);
+    while (true) {
+        uint64_t e;
+        MPI_Recv(&e, 1, MPI_UINT64_T, top, tag_help_exponent, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+        if (e == helpers_done) {
+            break;
+        }
+        assert(e <= largest);
+        if (!cut[e]) {
+            precompute_wait(pre, e);
+            karatsuba_piece(&pieces[e], &p3[e], depth, k);
+            cut[e] = true;
+        }
+        recv_limbs(x, top, tag_help_piece);
+        fmpz_mul(product, x, &pieces[e]);
+        send_limbs(product, top, tag_help_product);
+    }
+    fmpz_clear(x); fmpz_clear(product);
+    for (fmpz& piece : pieces) {
+        fmpz_clear(&piece);
+    }
+    precompute_stop(pre);
+}
+
+// The funnel tests and benchmarks run without a config.
+bool helped(data_t* data, uint64_t e) {
+    return data->config != nullptr && data->config->helpers > 0 && data->segment->is_top_segment && e >= data->config->help_from;
+}
+
+void helped_mul(data_t* data, fmpz_t rop, const fmpz_t x, uint64_t e) {
+    // Helpers aren't in the chain's communicator, so they are addressed
+    // in MPI_COMM_WORLD, which segment_init only lets match the chain.
+    int chain_rank, world_rank;
+    MPI_Comm_rank(data->transport->comm, &chain_rank);
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    friendly_assert(chain_rank == world_rank && data->config->topology.empty(), "Helpers need the chain in MPI_COMM_WORLD order.");
+    const int depth = helper_depth(data->config->helpers);
+    const fmpz* p = power_of_3(data, e);
+    std::vector<fmpz> pieces = {};
+    std::vector<uint64_t> splits = {};
+    karatsuba_pieces(x, p, depth, &pieces, &splits);
+    const uint64_t n = pieces.size();
+    const int first = data->segment->world_size;
+    uint64_t exponent = e;
+    std::vector<mp_limb_t> singles(n);
+    std::vector<MPI_Request> requests(2*(n-1));
+    for (uint64_t k = 1; k < n; k++) {
+        const int rank = first + k-1;
+        int limbs;
+        mp_srcptr source = piece_limbs(&pieces[k], &singles[k], &limbs);
+        MPI_Isend(&exponent, 1, MPI_UINT64_T, rank, tag_help_exponent, MPI_COMM_WORLD, &requests[2*k-2]);
+        MPI_Isend(source, limbs, MPI_UINT64_T, rank, tag_help_piece, MPI_COMM_WORLD, &requests[2*k-1]);
+    }
+    // our own share, while the helpers work on theirs
+    std::vector<fmpz> products(n, 0);
+    fmpz_t own; fmpz_init(own);
+    karatsuba_piece(own, p, depth, 0);
+    fmpz_mul(&products[0], &pieces[0], own);
+    fmpz_clear(own);
+    for (uint64_t k = 1; k < n; k++) {
+        recv_limbs(&products[k], first + k-1, tag_help_product);
+    }
+    MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+    const uint64_t* next = splits.data();
+    karatsuba_combine(rop, products.data(), &next, depth);
+    for (uint64_t k = 0; k < n; k++) {
+        fmpz_clear(&pieces[k]);
+        fmpz_clear(&products[k]);
+    }
+    counter_count(data->metrics, multiplications_helped);
+}
+
+void helpers_finalize(data_t* data) {
+    if (data->config->helpers == 0 || !data->segment->is_top_segment) {
+        return;
+    }
+    uint64_t done = helpers_done;
+    for (uint64_t k = 0; k < data->config->helpers; k++) {
+        MPI_Send(&done, 1, MPI_UINT64_T, data->segment->world_size + k, tag_help_exponent, MPI_COMM_WORLD);
+    }
+}
+
+// Every group member's piece of p has to match what karatsuba_pieces
+// cut, and the products have to come back together to x*p.
+void test_karatsuba_pieces() {
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    fmpz_t x, p, piece, got, expected;
+    fmpz_init(x); fmpz_init(p); fmpz_init(piece); fmpz_init(got); fmpz_init(expected);
+    assert(helper_depth(0) == -1 && helper_depth(2) == 1 && helper_depth(8) == 2 && helper_depth(3) == -1);
+    for (int depth = 1; depth <= 3; depth++) {
+        // x wider than p, like the high part of a block
+        fmpz_randbits_unsigned(x, rand, 5000);
+        fmpz_set_ui(p, 3);
+        fmpz_pow_ui(p, p, 1<<11);
+        std::vector<fmpz> pieces = {};
+        std::vector<uint64_t> splits = {};
+        karatsuba_pieces(x, p, depth, &pieces, &splits);
+        assert(pieces.size() == pow3(depth));
+        std::vector<fmpz> products(pieces.size(), 0);
+        for (uint64_t k = 0; k < pieces.size(); k++) {
+            karatsuba_piece(piece, p, depth, k);
+            fmpz_mul(&products[k], &pieces[k], piece);
+        }
+        const uint64_t* next = splits.data();
+        karatsuba_combine(got, products.data(), &next, depth);
+        assert(next == splits.data() + splits.size());
+        fmpz_mul(expected, x, p);
+        assert(fmpz_equal(got, expected));
+        for (uint64_t k = 0; k < pieces.size(); k++) {
+            fmpz_clear(&pieces[k]);
+            fmpz_clear(&products[k]);
+        }
+    }
+    fmpz_clear(x); fmpz_clear(p); fmpz_clear(piece); fmpz_clear(got); fmpz_clear(expected);
+    flint_rand_clear(rand);
+}
@@ -0,0 +1,158 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "json.h"
+
+void skip_space(const char** p) {
+    while (**p == ' ' || **p == '\n' || **p == '\r' || **p == '\t') {
+        (*p)++;
+    }
+}
+
+bool parse_value(const char** p, json_t* out);
+
+bool parse_string(const char** p, std::string* out) {
+    if (**p != '"') { return false; }
+    (*p)++;
+    *out = "";
+    while (**p != '"') {
+        if (**p == 0) { return false; }
+        if (**p == '\\') {
+            (*p)++;
+            switch (**p) {
+            case 'n': out->push_back('\n'); break;
+            case 't': out->push_back('\t'); break;
+            case 0: return false;
+            // \u escapes are passed through untouched, we never write them
+            default: out->push_back(**p); break;
+            }
+        } else {
+            out->push_back(**p);
+        }
+        (*p)++;
+    }
+    (*p)++;
+    return true;
+}
+
+// Arrays and objects share everything but the keys.
+bool parse_items(const char** p, json_t* out, char close) {
+    (*p)++;
+    skip_space(p);
+    if (**p == close) {
+        (*p)++;
+        return true;
+    }
+    while (true) {
+        skip_space(p);
+        if (close == '}') {
+            std::string key;
+            if (!parse_string(p, &key)) { return false; }
+            skip_space(p);
+            if (**p != ':') { return false; }
+            (*p)++;
+            out->keys.push_back(key);
+        }
+        out->items.push_back({});
+        if (!parse_value(p, &out->items.back())) { return false; }
+        skip_space(p);
+        if (**p == ',') {
+            (*p)++;
+        } else if (**p == close) {
+            (*p)++;
+            return true;
+        } else {
+            return false;
+        }
+    }
+}
+
+bool parse_value(const char** p, json_t* out) {
+    *out = {
+        .type = json_null,
+        .number = 0,
+        .string = "",
+        .items = {},
+        .keys = {},
+    };
+    skip_space(p);
+    switch (**p) {
+    case '{':
+        out->type = json_object;
+        return parse_items(p, out, '}');
+    case '[':
+        out->type = json_array;
+        return parse_items(p, out, ']');
+    case '"':
+        out->type = json_string;
+        return parse_string(p, &out->string);
+    case 'n':
+        *p += 4;
+        return strncmp(*p-4, "null", 4) == 0;
+    case 't':
+        out->type = json_bool;
+        out->number = 1;
+        *p += 4;
+        return strncmp(*p-4, "true", 4) == 0;
+    case 'f':
+        out->type = json_bool;
+        *p += 5;
+        return strncmp(*p-5, "false", 5) == 0;
+    default:
+        {
+            char* end;
+            out->type = json_number;
+            out->number = std::strtod(*p, &end);
+            if (end == *p) { return false; }
+            *p = end;
+            return true;
+        }
+    }
+}
+
+bool parse_json(const std::string& text, json_t* out) {
+    const char* p = text.c_str();
+    if (!parse_value(&p, out)) { return false; }
+    skip_space(&p);
+    return *p == 0;
+}
+
+bool read_json_file(const char* filename, json_t* out) {
+    std::ifstream f {filename};
+    if (!f) { return false; }
+    std::stringstream text;
+    text << f.rdbuf();
+    return parse_json(text.str(), out);
+}
+
+// nullptr if missing or not an object
+const json_t* json_get(const json_t* object, const char* key) {
+    if (object->type != json_object) { return nullptr; }
+    for (size_t i = 0; i < object->keys.size(); i++) {
+        if (object->keys[i] == key) {
+            return &object->items[i];
+        }
+    }
+    return nullptr;
+}
+
+void test_parse_json() {
+    json_t j;
+    assert(parse_json("{\"mode\": \"chain\", \"sizes\": [10, 2.5e3], \"means\": [[null, -1]], \"ok\": true}", &j));
+    assert(j.type == json_object);
+    assert(json_get(&j, "mode")->string == "chain");
+    assert(json_get(&j, "sizes")->items.size() == 2);
+    assert(json_get(&j, "sizes")->items[1].number == 2500);
+    assert(json_get(&j, "means")->items[0].items[0].type == json_null);
+    assert(json_get(&j, "means")->items[0].items[1].number == -1);
+    assert(json_get(&j, "ok")->number == 1);
+    assert(json_get(&j, "missing") == nullptr);
+    assert(parse_json(" [ ] ", &j) && j.items.size() == 0);
+    assert(!parse_json("[1, 2", &j));
+    assert(!parse_json("{\"a\" 1}", &j));
+    assert(!parse_json("[1] x", &j));
+}
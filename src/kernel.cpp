@@ -0,0 +1,323 @@
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "kernel.h"
+
+limb_span_t limbs_of(const fmpz_t f, mp_limb_t* single) {
+    assert(fmpz_sgn(f) >= 0);
+    if (!COEFF_IS_MPZ(*f)) {
+        *single = static_cast<mp_limb_t>(*f);
+        return { .limbs = single, .size = *f != 0 };
+    }
+    mpz_srcptr z = COEFF_TO_PTR(*f);
+    return { .limbs = mpz_limbs_read(z), .size = static_cast<mp_size_t>(mpz_size(z)) };
+}
+
+static mp_size_t normalized(mp_srcptr p, mp_size_t n) {
+    while (n > 0 && p[n-1] == 0) {
+        n--;
+    }
+    return n;
+}
+
+bit_slice_t slice_of(const fmpz_t f, mp_limb_t* single, flint_bitcnt_t from) {
+    const limb_span_t span = limbs_of(f, single);
+    const mp_size_t q = from / GMP_NUMB_BITS;
+    if (q >= span.size) {
+        return { .limbs = span.limbs, .size = 0, .shift = 0 };
+    }
+    return { .limbs = span.limbs + q, .size = span.size - q, .shift = static_cast<unsigned>(from % GMP_NUMB_BITS) };
+}
+
+limb_span_t slice_limbs(bit_slice_t slice, mp_ptr buffer) {
+    if (slice.shift == 0 || slice.size == 0) {
+        return { .limbs = slice.limbs, .size = slice.size };
+    }
+    mpn_rshift(buffer, slice.limbs, slice.size, slice.shift);
+    return { .limbs = buffer, .size = normalized(buffer, slice.size) };
+}
+
+template<typename backend> void mul_split_with(fmpz_t high, fmpz_t low, const fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t bits) {
+    assert(low != x && low != y && low != add && high != low);
+    assert(high != y && high != add);
+    assert(fmpz_sgn(x) >= 0 && fmpz_sgn(y) >= 0 && fmpz_sgn(add) >= 0);
+    mp_limb_t x1, y1;
+    const limb_span_t xs = limbs_of(x, &x1);
+    const limb_span_t ys = limbs_of(y, &y1);
+    mp_srcptr xp = xs.limbs, yp = ys.limbs;
+    mp_size_t xn = xs.size, yn = ys.size;
+    if (xn < yn) {
+        std::swap(xp, yp);
+        std::swap(xn, yn);
+    }
+    if (yn == 0) {
+        fmpz_zero(low);
+        fmpz_set(high, add);
+        return;
+    }
+
+    // The product goes into low, the only destination that is free to
+    // overwrite, and then changes places with high.
+    mpz_ptr product = _fmpz_promote(low);
+    const mp_size_t pn = xn + yn;
+    mp_ptr pp = mpz_limbs_write(product, pn);
+    backend::mul(pp, xp, xn, yp, yn);
+    mp_size_t n = normalized(pp, pn);
+    fmpz_swap(high, low);
+
+    mp_size_t hn = n;
+    if (bits == 0) {
+        // the whole product is the high part, nothing to split off
+        fmpz_zero(low);
+    } else {
+        const mp_size_t q = bits / GMP_NUMB_BITS;
+        const unsigned r = bits % GMP_NUMB_BITS;
+        mp_size_t ln = q + (r > 0);
+        ln = ln < n ? ln : n;
+        mpz_ptr rest = _fmpz_promote(low);
+        mp_ptr lp = mpz_limbs_write(rest, ln > 0 ? ln : 1);
+        mpn_copyi(lp, pp, ln);
+        if (r > 0 && ln == q+1) {
+            lp[q] &= ((mp_limb_t)1<<r) - 1;
+        }
+        mpz_limbs_finish(rest, normalized(lp, ln));
+        _fmpz_demote_val(low);
+
+        hn = n > q ? n - q : 0;
+        if (hn > 0) {
+            if (r > 0) {
+                mpn_rshift(pp, pp + q, hn, r);
+            } else {
+                mpn_copyi(pp, pp + q, hn);
+            }
+            hn = normalized(pp, hn);
+        }
+    }
+    mp_limb_t a1;
+    const limb_span_t as = limbs_of(add, &a1);
+    mp_srcptr ap = as.limbs;
+    const mp_size_t an = as.size;
+    if (an > 0) {
+        const mp_size_t sn = (hn > an ? hn : an) + 1;
+        pp = mpz_limbs_modify(product, sn);
+        if (hn >= an) {
+            pp[hn] = mpn_add(pp, pp, hn, ap, an);
+        } else {
+            mpn_zero(pp + hn, an - hn);
+            pp[an] = mpn_add_n(pp, pp, ap, an);
+        }
+        hn = normalized(pp, sn);
+    }
+    mpz_limbs_finish(product, hn);
+    _fmpz_demote_val(high);
+}
+
+template void mul_split_with<flint_backend>(fmpz_t, fmpz_t, const fmpz_t, const fmpz_t, const fmpz_t, flint_bitcnt_t);
+template void mul_split_with<gmp_backend>(fmpz_t, fmpz_t, const fmpz_t, const fmpz_t, const fmpz_t, flint_bitcnt_t);
+#ifdef FLINT_HAVE_FFT_SMALL
+template void mul_split_with<fft_small_backend>(fmpz_t, fmpz_t, const fmpz_t, const fmpz_t, const fmpz_t, flint_bitcnt_t);
+#endif
+
+void mul_split(fmpz_t high, fmpz_t low, const fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t bits) {
+    mul_split_with<backend_t>(high, low, x, y, add, bits);
+}
+
+// The product goes into a scratch number that stays around and then
+// changes places with x, so the two take turns with their limbs
+// instead of allocating them for every product. The bits of x below
+// from go with the limbs that x gives up.
+void mul_add(fmpz_t x, const fmpz_t y, const fmpz_t add, flint_bitcnt_t from) {
+    assert(fmpz_sgn(x) >= 0 && fmpz_sgn(y) >= 0 && fmpz_sgn(add) >= 0);
+    thread_local fmpz scratch = 0;
+    thread_local std::vector<mp_limb_t> shifted = {};
+    assert(x != &scratch);
+    mp_limb_t x1, y1, a1;
+    const bit_slice_t slice = slice_of(x, &x1, from);
+    if (slice.shift != 0) {
+        shifted.resize(std::max<size_t>(shifted.size(), slice.size));
+    }
+    const limb_span_t xs = slice_limbs(slice, shifted.data());
+    const limb_span_t ys = limbs_of(y, &y1);
+    const limb_span_t as = limbs_of(add, &a1);
+    if (xs.size == 0 || ys.size == 0) {
+        fmpz_set(x, add);
+        return;
+    }
+    const bool x_longer = xs.size >= ys.size;
+    const limb_span_t a = x_longer ? xs : ys;
+    const limb_span_t b = x_longer ? ys : xs;
+    const mp_size_t pn = a.size + b.size;
+    // add may be the longer one
+    const mp_size_t n = std::max(pn, as.size);
+    mpz_ptr product = _fmpz_promote(&scratch);
+    mp_ptr pp = mpz_limbs_write(product, n+1);
+    backend_t::mul(pp, a.limbs, a.size, b.limbs, b.size);
+    mpn_zero(pp + pn, n - pn);
+    pp[n] = as.size > 0 ? mpn_add(pp, pp, n, as.limbs, as.size) : 0;
+    mpz_limbs_finish(product, normalized(pp, n+1));
+    _fmpz_demote_val(&scratch);
+    fmpz_swap(x, &scratch);
+}
+
+void add_2exp(fmpz_t rop, const fmpz_t x, flint_bitcnt_t bits) {
+    assert(rop != x && fmpz_sgn(rop) >= 0);
+    thread_local std::vector<mp_limb_t> shifted = {};
+    mp_limb_t x1;
+    limb_span_t xs = limbs_of(x, &x1);
+    if (xs.size == 0) {
+        return;
+    }
+    const mp_size_t q = bits / GMP_NUMB_BITS;
+    const unsigned r = bits % GMP_NUMB_BITS;
+    if (r > 0) {
+        // off a limb boundary, x has to be shifted after all
+        shifted.resize(std::max<size_t>(shifted.size(), xs.size + 1));
+        shifted[xs.size] = mpn_lshift(shifted.data(), xs.limbs, xs.size, r);
+        xs = { .limbs = shifted.data(), .size = xs.size + 1 };
+    }
+    mpz_ptr z = _fmpz_promote_val(rop);
+    const mp_size_t rn = mpz_size(z);
+    const mp_size_t n = std::max(rn, q + xs.size) + 1;
+    mp_ptr rp = mpz_limbs_modify(z, n);
+    mpn_zero(rp + rn, n - rn);
+    // the extra limb takes the carry
+    mpn_add(rp + q, rp + q, n - q, xs.limbs, xs.size);
+    mpz_limbs_finish(z, normalized(rp, n));
+    _fmpz_demote_val(rop);
+}
+
+void split_2exp(fmpz_t high, fmpz_t low, const fmpz_t x, flint_bitcnt_t bits) {
+    assert(high != low);
+    if (!COEFF_IS_MPZ(*x) || (x != high && x != low)) {
+        // the one aliasing x goes last
+        if (x == high) {
+            fmpz_fdiv_r_2exp(low, x, bits);
+            fmpz_fdiv_q_2exp(high, x, bits);
+        } else {
+            fmpz_fdiv_q_2exp(high, x, bits);
+            fmpz_fdiv_r_2exp(low, x, bits);
+        }
+        return;
+    }
+    mpz_ptr z = COEFF_TO_PTR(*x);
+    if (x == high) {
+        fmpz_fdiv_r_2exp(low, x, bits);
+        mpz_fdiv_q_2exp(z, z, bits);
+        _fmpz_demote_val(high);
+    } else {
+        fmpz_fdiv_q_2exp(high, x, bits);
+        mpz_fdiv_r_2exp(z, z, bits);
+        _fmpz_demote_val(low);
+    }
+}
+
+template<typename backend> void test_mul_split_with() {
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    fmpz_t x, y, add, high, low, expect_high, expect_low;
+    fmpz_init(x); fmpz_init(y); fmpz_init(add); fmpz_init(high); fmpz_init(low);
+    fmpz_init(expect_high); fmpz_init(expect_low);
+    const flint_bitcnt_t sizes[] = {0, 1, 20, 63, 64, 65, 200, 640, 2000};
+    for (flint_bitcnt_t xs : sizes) {
+        for (flint_bitcnt_t as : sizes) {
+            for (flint_bitcnt_t bits : {0, 1, 32, 64, 128, 256, 1000, 4096}) {
+                fmpz_randbits_unsigned(x, rand, xs);
+                fmpz_randbits_unsigned(y, rand, 300);
+                fmpz_randbits_unsigned(add, rand, as);
+                fmpz_mul(expect_low, x, y);
+                fmpz_fdiv_q_2exp(expect_high, expect_low, bits);
+                fmpz_add(expect_high, expect_high, add);
+                fmpz_fdiv_r_2exp(expect_low, expect_low, bits);
+
+                mul_split_with<backend>(high, low, x, y, add, bits);
+                assert(fmpz_equal(high, expect_high));
+                assert(fmpz_equal(low, expect_low));
+                // and in place, the way the chain uses it
+                mul_split_with<backend>(x, low, x, y, add, bits);
+                assert(fmpz_equal(x, expect_high));
+                assert(fmpz_equal(low, expect_low));
+            }
+        }
+    }
+    fmpz_clear(x); fmpz_clear(y); fmpz_clear(add); fmpz_clear(high); fmpz_clear(low);
+    fmpz_clear(expect_high); fmpz_clear(expect_low);
+    flint_rand_clear(rand);
+}
+
+void test_mul_split() {
+    test_mul_split_with<flint_backend>();
+    test_mul_split_with<gmp_backend>();
+    #ifdef FLINT_HAVE_FFT_SMALL
+    test_mul_split_with<fft_small_backend>();
+    #endif
+
+    fmpz_t x, y, add, expect;
+    fmpz_init_set_ui(x, 1000);
+    fmpz_init_set_ui(y, 3);
+    fmpz_init_set_ui(add, 7);
+    fmpz_init(expect);
+    fmpz_mul_2exp(x, x, 300);
+    fmpz_mul(expect, x, y);
+    fmpz_add(expect, expect, add);
+    mul_add(x, y, add, 0);
+    assert(fmpz_equal(x, expect));
+    // an add longer than the product
+    fmpz_set_ui(x, 5);
+    fmpz_mul_2exp(add, add, 500);
+    fmpz_add_ui(expect, add, 15);
+    mul_add(x, y, add, 0);
+    assert(fmpz_equal(x, expect));
+
+    // through slices, on and off limb boundaries, and past the top
+    fmpz_t shifted, low;
+    fmpz_init(shifted); fmpz_init(low);
+    for (const flint_bitcnt_t from : {1, 64, 100, 128, 800, 2000}) {
+        fmpz_set(x, expect);
+        fmpz_mul_2exp(x, x, 300);
+        fmpz_add_ui(x, x, 12345);
+        fmpz_fdiv_q_2exp(shifted, x, from);
+        fmpz_mul(shifted, shifted, y);
+        fmpz_add(shifted, shifted, add);
+        mul_add(x, y, add, from);
+        assert(fmpz_equal(x, shifted));
+
+        // rop shorter, longer and small
+        for (const flint_bitcnt_t rs : {0, 10, 200, 4000}) {
+            fmpz_set_ui(low, 1);
+            fmpz_mul_2exp(low, low, rs);
+            fmpz_sub_ui(low, low, 1);
+            fmpz_mul_2exp(shifted, expect, from);
+            fmpz_add(shifted, shifted, low);
+            add_2exp(low, expect, from);
+            assert(fmpz_equal(low, shifted));
+        }
+    }
+    fmpz_clear(shifted);
+
+    // in place either way, keeping the limbs
+    fmpz_t high;
+    fmpz_init(high);
+    for (const flint_bitcnt_t bits : {3, 64, 300, 600}) {
+        fmpz_set(low, expect);
+        mpz_realloc2(COEFF_TO_PTR(*low), 4096);
+        split_2exp(high, low, low, bits);
+        assert(!COEFF_IS_MPZ(*low) || COEFF_TO_PTR(*low)->_mp_alloc == 64);
+        assert(bits < 600 || COEFF_IS_MPZ(*low));
+        fmpz_mul_2exp(high, high, bits);
+        fmpz_add(high, high, low);
+        assert(fmpz_equal(high, expect));
+        fmpz_set(high, expect);
+        split_2exp(high, low, high, bits);
+        fmpz_mul_2exp(high, high, bits);
+        fmpz_add(high, high, low);
+        assert(fmpz_equal(high, expect));
+    }
+    fmpz_clear(high); fmpz_clear(low);
+    fmpz_clear(x); fmpz_clear(y); fmpz_clear(add); fmpz_clear(expect);
+}
@@ -5,6 +5,9 @@
 #include <cassert>
 #include <vector>
 #include <cmath>
+#include <limits>
+#include <fstream>
+#include <getopt.h>
 
 #include "common.h"
 #include "communicate.h"
@@ -13,6 +16,114 @@
 #include "friendly_assert.h"
 #include "latencies.h"
 
+// --sizes 16,24,30
+// --counts 4096,64,2
+// --sweep 10-30
+// --chain
+// --output latencies.json
+// --verbose
+
+static struct option longopts[] = {
+    { "sizes",      required_argument,  NULL, 's' },
+    { "counts",     required_argument,  NULL, 'n' },
+    { "sweep",      required_argument,  NULL, 'w' },
+    { "chain",      no_argument,        NULL, 'c' },
+    { "output",     required_argument,  NULL, 'o' },
+    { "verbose",    no_argument,        NULL, 'v' },
+    { NULL,         0,                  NULL,  0  },
+};
+
+vec<uint64_t> parse_list(char* ptr) {
+    vec<uint64_t> list = {};
+    while (*ptr != 0) {
+        list.push_back(std::strtoull(ptr, &ptr, 10));
+        if (*ptr == ',' || *ptr == '-') { ptr++; }
+    }
+    return list;
+}
+
+// Enough repetitions to average out small messages, without
+// spending minutes on the big ones.
+uint64_t default_count(uint64_t size) {
+    if (size >= 29) { return 2; }
+    const uint64_t count = (uint64_t)1<<(30-size);
+    return count > 4096 ? 4096 : count;
+}
+
+void parse_latencies_args(latencies_config_t* config, int argc, char** argv) {
+    *config = {
+        .sizes = {16, 24, 30},
+        .counts = {},
+        .mode = mode_pairs,
+        .output = "latencies.json",
+        .verbose = false,
+    };
+    int ch;
+    while((ch = getopt_long_only(argc, argv, "s:n:w:co:v", longopts, NULL)) != -1) {
+        switch (ch) {
+        case 's':
+            config->sizes = parse_list(optarg);
+            break;
+        case 'n':
+            config->counts = parse_list(optarg);
+            break;
+        case 'w':
+            {
+                const vec<uint64_t> range = parse_list(optarg);
+                friendly_assert(range.size() == 2 && range[0] <= range[1], "--sweep expects a range like 10-30.");
+                config->sizes = {};
+                for (uint64_t size = range[0]; size <= range[1]; size++) {
+                    config->sizes.push_back(size);
+                }
+            }
+            break;
+        case 'c':
+            config->mode = mode_chain;
+            break;
+        case 'o':
+            config->output = optarg;
+            break;
+        case 'v':
+            config->verbose = true;
+            break;
+        case 0:
+            fprintf(stderr, "arg parse discovered null argument\n");
+            break;
+        }
+    }
+    friendly_assert(config->counts.size() <= config->sizes.size(), "More counts than sizes.");
+    for (size_t i = config->counts.size(); i < config->sizes.size(); i++) {
+        config->counts.push_back(default_count(config->sizes[i]));
+    }
+}
+
+void test_parse_latencies_args() {
+    latencies_config_t config;
+    std::vector<char*> vec = { NULL, (char*)"--sizes", (char*)"12,20,28", (char*)"--counts", (char*)"100", (char*)"--chain", (char*)"--output", (char*)"-" };
+    optind = 0;
+    #ifdef optreset
+    optreset = 1;
+    #endif // optreset
+    parse_latencies_args(&config, 8, &vec[0]);
+    assert(std::vector<uint64_t>({12, 20, 28}) == config.sizes);
+    assert(std::vector<uint64_t>({100, 1024, 4}) == config.counts);
+    assert(config.mode == mode_chain);
+    assert(config.output == "-");
+    assert(!config.verbose);
+
+    vec = { NULL, (char*)"-w", (char*)"14-16", (char*)"-v" };
+    optind = 0;
+    #ifdef optreset
+    optreset = 1;
+    #endif // optreset
+    parse_latencies_args(&config, 4, &vec[0]);
+    assert(std::vector<uint64_t>({14, 15, 16}) == config.sizes);
+    assert(std::vector<uint64_t>({4096, 4096, 4096}) == config.counts);
+    assert(config.mode == mode_pairs);
+    assert(config.output == "latencies.json");
+    assert(config.verbose);
+}
+
 int get_opponent(int rank, int size, int step) {
     const bool even = size % 2 == 0;
     int base = even ? size-1 : size;
@@ -77,23 +188,55 @@ void test_get_opponent() {
     exit(has_error ? 1 : 0);
 }
 
-double time_swap(metrics_t* metrics, int rank, int other, fmpz_t in_num, fmpz_t out_num) {
+// Between ranks of MPI_COMM_WORLD, which is what --topology reorders.
+double time_swap(metrics_t* metrics, int rank, int other, fmpz_t in_num, fmpz_t out_num, bool verbose) {
     auto start = nanos();
     // lower node sends first
     if (rank == other) {
         fmpz_set(in_num, out_num);
     } else if (rank < other) {
-        send(metrics, other, 0, out_num);
-        recv(metrics, other, 0, in_num);
+        send(metrics, MPI_COMM_WORLD, other, 0, out_num);
+        recv(metrics, MPI_COMM_WORLD, other, 0, in_num);
     } else {
-        recv(metrics, other, 0, in_num);
-        send(metrics, other, 0, out_num);
+        recv(metrics, MPI_COMM_WORLD, other, 0, in_num);
+        send(metrics, MPI_COMM_WORLD, other, 0, out_num);
     }
     const auto time = seconds(nanos() - start);
-    std::cout << "single swap took " << time << std::endl;
+    if (verbose) {
+        std::cout << "single swap took " << time << std::endl;
+    }
     return time;
 }
 
+void add_summary(stats_t* stats, const vec<double>& times) {
+    const size_t repetitions = times.size();
+    double mean = 0;
+    for (size_t j = 0; j < repetitions; j++) {
+        mean += times[j];
+    }
+    mean /= static_cast<double>(repetitions);
+    double stddev = std::numeric_limits<double>::quiet_NaN();
+    if (repetitions > 1) {
+        double sum = 0;
+        for (size_t j = 0; j < repetitions; j++) {
+            const double d = times[j]-mean;
+            sum += d*d;
+        }
+        stddev = sqrt(sum/static_cast<double>(repetitions-1));
+    }
+    stats->means.push_back(mean);
+    stats->stddevs.push_back(stddev);
+}
+
+// Pairs nobody measured stay NaN and are written out as null.
+stats_t unmeasured(latencies_config_t* config) {
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    return {
+        .means = vec<double>(config->sizes.size(), nan),
+        .stddevs = vec<double>(config->sizes.size(), nan),
+    };
+}
+
 stats_t make_stat_against(metrics_t* metrics, latencies_config_t* config, int rank, int other, flint_rand_t rand) {
     stats_t stats = {
         .means = {},
@@ -105,23 +248,11 @@ stats_t make_stat_against(metrics_t* metrics, latencies_config_t* config, int ra
         fmpz_t recv_num; fmpz_init(recv_num);
         fmpz_randbits_unsigned(send_num, rand, (uint64_t)1<<config->sizes[i]);
         vec<double> times = {};
-        double mean = 0;
         const size_t repetitions = config->counts[i];
         for (size_t j = 0; j < repetitions; j++) {
-            const double t = time_swap(metrics, rank, other, recv_num, send_num);
-            times.push_back(t);
-            mean += t;
-        }
-        // TODO: assert?
-        mean /= static_cast<double>(repetitions);
-        double stddev = 0;
-        for (size_t j = 0; j < repetitions; j++) {
-            const double d = times[j]-mean;
-            stddev += d*d;
+            times.push_back(time_swap(metrics, rank, other, recv_num, send_num, config->verbose));
         }
-        stddev = sqrt(stddev)/(static_cast<double>(repetitions-1));
-        stats.means.push_back(mean);
-        stats.stddevs.push_back(stddev);
+        add_summary(&stats, times);
         fmpz_clear(send_num);
         fmpz_clear(recv_num);
     }
@@ -139,23 +270,96 @@ vec<stats_t> make_stats(metrics_t* metrics, latencies_config_t* config, int rank
     for (int n = 0; n < size; n++) {
         other = get_opponent(rank, size, n);
         if (other < 0) { break; }
-        std::cout << "rank " << rank << " versus " << other << std::endl;
+        if (config->verbose) {
+            std::cout << "rank " << rank << " versus " << other << std::endl;
+        }
         list[other] = make_stat_against(metrics, config, rank, other, rand);
     }
     // TODO: should get_opponent use a more consistent policy here?
     if (list[rank].means.size() == 0) {
-        std::cout << "rank " << rank << " versus " << rank << std::endl;
+        if (config->verbose) {
+            std::cout << "rank " << rank << " versus " << rank << std::endl;
+        }
         list[rank] = make_stat_against(metrics, config, rank, rank, rand);
     }
     flint_rand_clear(rand);
     return list;
 }
 
+// Every rank swaps with both neighbors at once, in the same order and
+// through the same transport as recursive_burn: receive then send on
+// the right, send then receive on the left. Only the two neighbors of
+// each rank get an entry.
+vec<stats_t> make_chain_stats(metrics_t* metrics, latencies_config_t* config, int rank, int size) {
+    uint64_t largest = 0;
+    for (uint64_t s : config->sizes) {
+        largest = s > largest ? s : largest;
+    }
+    segment_t segment = {
+        .world_size = size,
+        .world_rank = rank,
+        .is_base_segment = rank == 0,
+        .is_top_segment = rank == size-1,
+    };
+    vars_t vars = {};
+    vars.lanes = 1;
+    vars.block_size = {largest};
+    data_t data = {};
+    data.segment = &segment;
+    data.vars = &vars;
+    data.metrics = metrics;
+    transport_init({&data});
+
+    vec<stats_t> list = {};
+    for (int n = 0; n < size; n++) {
+        list.push_back(unmeasured(config));
+    }
+    stats_t right = {.means={},.stddevs={}};
+    stats_t left = {.means={},.stddevs={}};
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    for (size_t i = 0; i < config->sizes.size(); i++) {
+        fmpz_t send_num; fmpz_init(send_num);
+        fmpz_t recv_num; fmpz_init(recv_num);
+        fmpz_randbits_unsigned(send_num, rand, (uint64_t)1<<config->sizes[i]);
+        vec<double> right_times = {};
+        vec<double> left_times = {};
+        MPI_Barrier(MPI_COMM_WORLD);
+        for (size_t j = 0; j < config->counts[i]; j++) {
+            if (!segment.is_base_segment) {
+                const auto start = nanos();
+                fmpz_zero(recv_num);
+                receiveRightAdd(&data, recv_num);
+                sendRight(&data, send_num);
+                right_times.push_back(seconds(nanos() - start));
+            }
+            if (!segment.is_top_segment) {
+                const auto start = nanos();
+                sendLeft(&data, send_num);
+                fmpz_zero(recv_num);
+                receiveLeftAdd(&data, recv_num);
+                left_times.push_back(seconds(nanos() - start));
+            }
+        }
+        if (!segment.is_base_segment) { add_summary(&right, right_times); }
+        if (!segment.is_top_segment) { add_summary(&left, left_times); }
+        fmpz_clear(send_num);
+        fmpz_clear(recv_num);
+    }
+    flint_rand_clear(rand);
+    if (!segment.is_base_segment) { list[rank-1] = right; }
+    if (!segment.is_top_segment) { list[rank+1] = left; }
+    transport_finalize(&data);
+    return list;
+}
+
 vec<latency_matrix_t> gather_stats(latencies_config_t* config, int rank, int world_size) {
     metrics_t metrics;
     init_metrics(&metrics, 0);
 
-    vec<stats_t> stats = make_stats(&metrics, config, rank, world_size);
+    vec<stats_t> stats = config->mode == mode_chain
+        ? make_chain_stats(&metrics, config, rank, world_size)
+        : make_stats(&metrics, config, rank, world_size);
     // What we have here is, for each node, a stats[other_node][means|stddevs][size];
     // It'll be serialized into doubles[world_size * 2 * size_groups];
 
@@ -179,15 +383,11 @@ vec<latency_matrix_t> gather_stats(latencies_config_t* config, int rank, int wor
         matrix_buffer = (double*) malloc (world_size * doubles_count * sizeof(double));
     }
 
-    std::cout << "about to gather" << std::endl;
     MPI_Gather(doubles, doubles_count, MPI_DOUBLE, matrix_buffer, doubles_count, MPI_DOUBLE, root, MPI_COMM_WORLD);
-    std::cout << "gathered" << std::endl;
     free(doubles);
 
     if (rank != root) { return {}; }
 
-    free(matrix_buffer);
-
     vec<latency_matrix_t> latency_matrices = {};
 
     for (size_t size_ind = 0; size_ind < size_groups; size_ind++) {
@@ -211,66 +411,87 @@ vec<latency_matrix_t> gather_stats(latencies_config_t* config, int rank, int wor
             }
         }
     }
+    free(matrix_buffer);
     return latency_matrices;
 }
 
-void print_stats(latencies_config_t* config, int world_rank, int world_size, vec<latency_matrix_t> stats) {
-    if (world_rank != 0) { return; }
-    std::cout << "{\"sizes\": [";
-    for (size_t size_ind = 0; size_ind < config->sizes.size(); size_ind++) {
-        if (size_ind != 0) {
-            std::cout << ", ";
-        }
-        std::cout << config->sizes[size_ind];
+void print_number(std::ostream& out, double x) {
+    if (std::isnan(x)) {
+        out << "null";
+    } else {
+        out << x;
     }
-    std::cout << "], \"counts\": [";
-    for (size_t size_ind = 0; size_ind < config->sizes.size(); size_ind++) {
-        if (size_ind != 0) {
-            std::cout << ", ";
+}
+
+void print_list(std::ostream& out, const vec<uint64_t>& list) {
+    out << "[";
+    for (size_t i = 0; i < list.size(); i++) {
+        if (i != 0) {
+            out << ", ";
         }
-        std::cout << config->counts[size_ind];
+        out << list[i];
     }
-    std::cout << "], \"means\": [";
+    out << "]";
+}
+
+// [size][source][target], scaled per size
+void print_matrices(std::ostream& out, latencies_config_t* config, int world_size, const vec<double*>& matrices, const vec<double>& scale) {
+    out << "[";
     for (size_t size_ind = 0; size_ind < config->sizes.size(); size_ind++) {
         if (size_ind != 0) {
-            std::cout << ", ";
+            out << ", ";
         }
-        std::cout << "[";
+        out << "[";
         for (int source = 0; source < world_size; source++) {
             if (source != 0) {
-                std::cout << ", ";
+                out << ", ";
             }
-            std::cout << "[";
+            out << "[";
             for (int target = 0; target < world_size; target++) {
                 if (target != 0) {
-                    std::cout << ", ";
+                    out << ", ";
                 }
-                std::cout << stats[size_ind].means[source * world_size + target];
+                const double x = matrices[size_ind][source * world_size + target];
+                print_number(out, scale.empty() ? x : scale[size_ind] / x);
             }
-            std::cout << "]";
+            out << "]";
         }
-        std::cout << "]";
+        out << "]";
     }
-    std::cout << "], \"stddevs\": [";
+    out << "]";
+}
+
+// Times are seconds per exchange of one message each way; bandwidths
+// are the bytes of both messages over that time.
+void print_stats(latencies_config_t* config, int world_rank, int world_size, vec<latency_matrix_t> stats) {
+    if (world_rank != 0) { return; }
+    std::ofstream file;
+    if (config->output != "-") {
+        file.open(config->output);
+    }
+    std::ostream& out = config->output == "-" ? std::cout : file;
+    vec<double*> means = {};
+    vec<double*> stddevs = {};
+    vec<double> bytes = {};
     for (size_t size_ind = 0; size_ind < config->sizes.size(); size_ind++) {
-        if (size_ind != 0) {
-            std::cout << ", ";
-        }
-        std::cout << "[";
-        for (int source = 0; source < world_size; source++) {
-            if (source != 0) {
-                std::cout << ", ";
-            }
-            std::cout << "[";
-            for (int target = 0; target < world_size; target++) {
-                if (target != 0) {
-                    std::cout << ", ";
-                }
-                std::cout << stats[size_ind].stddevs[source * world_size + target];
-            }
-            std::cout << "]";
-        }
-        std::cout << "]";
+        means.push_back(stats[size_ind].means);
+        stddevs.push_back(stats[size_ind].stddevs);
+        bytes.push_back(2.0 * static_cast<double>((uint64_t)1<<config->sizes[size_ind]) / 8.0);
+    }
+    out << "{\"mode\": \"" << (config->mode == mode_chain ? "chain" : "pairs") << "\", \"ranks\": " << world_size;
+    out << ", \"sizes\": ";
+    print_list(out, config->sizes);
+    out << ", \"counts\": ";
+    print_list(out, config->counts);
+    out << ", \"means\": ";
+    print_matrices(out, config, world_size, means, {});
+    out << ", \"stddevs\": ";
+    print_matrices(out, config, world_size, stddevs, {});
+    out << ", \"bandwidths\": ";
+    print_matrices(out, config, world_size, means, bytes);
+    out << "}" << std::endl;
+    for (size_t size_ind = 0; size_ind < config->sizes.size(); size_ind++) {
+        free(stats[size_ind].means);
+        free(stats[size_ind].stddevs);
     }
-    std::cout << "]}" << std::endl;
 }
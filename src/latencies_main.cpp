@@ -4,7 +4,7 @@
 
 #include "latencies.h"
 
-int main() {
+int main(int argc, char** argv) {
     MPI_Init(NULL, NULL);
 
     int world_size;
@@ -13,10 +13,8 @@ int main() {
     int world_rank;
     MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
 
-    latencies_config_t config = {
-        .sizes = {16, 24, 30},
-        .counts = {4096, 64, 1},
-    };
+    latencies_config_t config;
+    parse_latencies_args(&config, argc, argv);
 
     vec<latency_matrix> stats = gather_stats(&config, world_rank, world_size);
 
@@ -25,4 +23,3 @@ int main() {
     MPI_Finalize();
 }
 
-
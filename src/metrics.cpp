@@ -1,4 +1,14 @@
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <cassert>
@@ -24,6 +34,8 @@ const char* timer_class_names[] = {
     "grinding basecase",
     "grinding chain",
     "gather communication",
+    "waiting for powers of 3",
+    "faulting in large blocks",
     "actively",
     "uh oh",
 };
@@ -31,9 +43,30 @@ const char* timer_class_names[] = {
 const char* counter_class_names[] = {
     "messages received from the right",
     "messages received from the right, nonempty",
+    "carries sent without payload",
+    "carries sent inline with their header",
+    "multiplications shared with helpers",
+    "steps slept through while dormant",
+    "blocks grown on top of the chain",
+    "limb arrays grown to their block's capacity",
+    "limb arrays allocated",
+    "limb arrays reallocated",
+    "bytes copied by reallocations",
+    "bytes mapped for large blocks",
     "uh oh",
 };
 
+const char* hardware_event_names[] = {
+    "cycles",
+    "instructions",
+    "last level cache misses",
+    "uh oh",
+};
+
+// There's no portable event for memory bandwidth, so every miss is
+// taken to bring in one cache line.
+const uint64_t cache_line_bytes = 64;
+
 start_time_t nanos() {
     return hydra_clock::now();
 }
@@ -68,15 +101,159 @@ void init_metrics(metrics_t* metrics, bool full_logs) {
     #else
     (void)full_logs;
     #endif
+    // until hardware_open, not every caller zeroes metrics
+    metrics->hardware.on = false;
+    metrics->profile = nullptr;
     // the rest are zero-initialized
 }
 
+void hardware_open(metrics_t* metrics) {
+    hardware_t* hardware = &metrics->hardware;
+    #ifdef __linux__
+    const uint64_t configs[_hardware_events] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+    int fds[_hardware_events];
+    bool inherit = true;
+    for (int i = 0; i < _hardware_events; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = configs[i];
+        attr.disabled = i == 0;
+        // what perf_event_paranoid 2 still allows
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        // FLINT's threads are only started later, in segment_init
+        attr.inherit = inherit;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+        if (fds[i] < 0 && i == 0 && errno == EINVAL && inherit) {
+            // older kernels don't read groups that inherit
+            std::cerr << "Hardware counters can't follow threads here, counting the calling thread only." << std::endl;
+            inherit = false;
+            i--;
+            continue;
+        }
+        if (fds[i] < 0) {
+            std::cerr << "Could not open hardware counter for " << hardware_event_names[i] << ": " << strerror(errno) << ", going without." << std::endl;
+            for (int k = 0; k < i; k++) {
+                close(fds[k]);
+            }
+            return;
+        }
+    }
+    hardware->fd = fds[0];
+    hardware->inherited = inherit;
+    hardware->on = true;
+    ioctl(hardware->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    #else
+    (void)hardware;
+    std::cerr << "Hardware counters need Linux, going without." << std::endl;
+    #endif
+}
+
+void hardware_close(metrics_t* metrics) {
+    #ifdef __linux__
+    if (metrics->hardware.on) {
+        // closing the leader leaves the others without a group, but
+        // they go with the process anyway
+        close(metrics->hardware.fd);
+        metrics->hardware.on = false;
+    }
+    #else
+    (void)metrics;
+    #endif
+}
+
+// Counts so far. When more groups are open than the core has counters,
+// the kernel takes turns between them, and the counts are scaled up to
+// the whole time.
+static void hardware_read(hardware_t* hardware, uint64_t* counts) {
+    #ifdef __linux__
+    uint64_t buffer[3 + _hardware_events];
+    const ssize_t got = read(hardware->fd, buffer, sizeof(buffer));
+    assert(got == sizeof(buffer) && buffer[0] == _hardware_events);
+    (void)got;
+    const uint64_t enabled = buffer[1];
+    const uint64_t running = buffer[2];
+    for (int i = 0; i < _hardware_events; i++) {
+        const uint64_t count = buffer[3 + i];
+        counts[i] = running == 0 || running == enabled ? count : static_cast<uint64_t>(static_cast<double>(count) * enabled / running);
+    }
+    #else
+    (void)hardware;
+    memset(counts, 0, _hardware_events*sizeof(uint64_t));
+    #endif
+}
+
+void profile_init(metrics_t* metrics) {
+    metrics->profile = (profile_t*) calloc(1, sizeof(profile_t));
+}
+
+level_profile_t* profile_entry(metrics_t* metrics, int level, uint64_t e) {
+    if (metrics->profile == nullptr) {
+        return nullptr;
+    }
+    level = std::min(level, profile_levels-1);
+    e = std::min(e, static_cast<uint64_t>(profile_exponents-1));
+    return &metrics->profile->entry[level][e];
+}
+
+void profile_count(level_profile_t* entry, profile_kind kind, uint64_t bits, start_time_t start) {
+    entry->calls[kind] += 1;
+    entry->bits[kind] += bits;
+    entry->time[kind] += nanos() - start;
+}
+
+// One line per block and step size that saw any work, largest first.
+// Every operation reads its operands and writes about as many bits, so
+// that's what it touches.
+static void dump_profile(const profile_t* profile) {
+    std::cout << "Funnel profile, per block from the bottom and log step size:" << std::endl;
+    std::cout << "\tblock\te\tmuls\tavg bits\tmul s\tsplits\tavg bits\tsplit s\tMB touched" << std::endl;
+    for (int level = profile_levels-1; level >= 0; level--) {
+        for (int e = profile_exponents-1; e >= 0; e--) {
+            const level_profile_t* entry = &profile->entry[level][e];
+            if (entry->calls[profile_multiply] + entry->calls[profile_split] == 0) {
+                continue;
+            }
+            std::cout << "\t" << level << "\t" << e;
+            for (int kind = 0; kind < _profile_kinds; kind++) {
+                const uint64_t calls = entry->calls[kind];
+                std::cout << "\t" << calls << "\t" << (calls > 0 ? entry->bits[kind]/calls : 0) << "\t" << seconds(entry->time[kind]);
+            }
+            const uint64_t bits = entry->bits[profile_multiply] + entry->bits[profile_split];
+            std::cout << "\t" << 2*bits/8/1e6 << std::endl;
+        }
+    }
+}
+
+// Which timers read the hardware counters.
+static bool hardware_timed(timer_class t) {
+    if (t == active_time) {
+        return true;
+    }
+    for (timer_class c : top_level) {
+        if (c == t) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void timer_start(metrics_t* metrics, timer_class t) {
     if (auto start = metrics->timers.last_start[t]) {
         std::cout << "ouch: Timer was started twice." << std::endl;
         assert(false);
     } else {
         metrics->timers.last_start[t] = hydra_clock::now();
+        if (metrics->hardware.on && hardware_timed(t)) {
+            hardware_read(&metrics->hardware, metrics->hardware.last_start[t]);
+        }
     }
 }
 
@@ -89,6 +266,17 @@ void timer_stop(metrics_t* metrics, timer_class t) {
         }
         metrics->timers.total[t] += delta;
         metrics->timers.last_start[t] = std::nullopt;
+        hardware_t* hardware = &metrics->hardware;
+        if (hardware->on && hardware_timed(t)) {
+            uint64_t counts[_hardware_events];
+            hardware_read(hardware, counts);
+            for (int i = 0; i < _hardware_events; i++) {
+                // scaling can make a count step back a little
+                if (counts[i] > hardware->last_start[t][i]) {
+                    hardware->total[t][i] += counts[i] - hardware->last_start[t][i];
+                }
+            }
+        }
         #ifndef NO_PLOT_LOGS
         if (metrics->timers.intervals[t] != std::nullopt) {
             metrics->timers.intervals[t].value().push_back({*start, stop});
@@ -100,10 +288,19 @@ void timer_stop(metrics_t* metrics, timer_class t) {
     }
 }
 
+// for time spent outside of any timer, e.g. measured by the allocator
+void timer_add(metrics_t* metrics, timer_class t, std::chrono::nanoseconds time) {
+    metrics->timers.total[t] += time;
+}
+
 void counter_count(metrics_t* metrics, counter_class t) {
     metrics->counters.counter[t] += 1;
 }
 
+void counter_add(metrics_t* metrics, counter_class t, uint64_t n) {
+    metrics->counters.counter[t] += n;
+}
+
 void dump_metrics(metrics_t* metrics, int rank) {
     std::string filename {"rank"};
     filename.append(std::to_string(rank));
@@ -119,6 +316,23 @@ void dump_metrics(metrics_t* metrics, int rank) {
         const auto counts = metrics->counters.counter[i];
         std::cout << "\t" << counts << " " << counter_class_names[i] << "." << std::endl;
     }
+    if (metrics->profile != nullptr) {
+        dump_profile(metrics->profile);
+    }
+    const hardware_t* hardware = &metrics->hardware;
+    if (hardware->on) {
+        std::cout << "Hardware counters per timer, " << (hardware->inherited ? "all threads" : "calling thread only") << ":" << std::endl;
+        for (int t = 0; t < _timer_classes; t++) {
+            const uint64_t* counts = hardware->total[t];
+            if (counts[hardware_cycles] == 0) {
+                continue;
+            }
+            const double ipc = static_cast<double>(counts[hardware_instructions]) / counts[hardware_cycles];
+            const double time = seconds(metrics->timers.total[t]);
+            const double bandwidth = time > 0 ? counts[hardware_cache_misses]*cache_line_bytes / time / 1e9 : 0;
+            std::cout << "\t" << counts[hardware_cycles] << " cycles, " << counts[hardware_instructions] << " instructions (" << ipc << " per cycle), " << counts[hardware_cache_misses] << " last level cache misses (~" << bandwidth << " GB/s from memory) " << timer_class_names[t] << "." << std::endl;
+        }
+    }
     #ifndef NO_PLOT_LOGS
     // do a bit of json
     // { "timer_class_a": [[start, stop], [start, stop]...], ... }
@@ -127,6 +341,7 @@ void dump_metrics(metrics_t* metrics, int rank) {
         return;
     }
     std::cout << "Dumping json timer intervals." << std::endl;
+    f.precision(9); // microseconds, even for long runs
     const start_time_t first_start = (*metrics->timers.intervals[active_time])[0].start;
     if (rank > 0) {
         f << ",";
@@ -150,6 +365,31 @@ void dump_metrics(metrics_t* metrics, int rank) {
             f << "]";
         }
     }
+    if (hardware->on) {
+        // { ..., "hardware counters": { "timer_class_a": { "cycles": n, ... }, ... },
+        //   "hardware counted threads": "all" or "calling" }
+        f << ",\"hardware counted threads\": \"" << (hardware->inherited ? "all" : "calling") << "\"";
+        f << ",\"hardware counters\": {";
+        bool first = true;
+        for (int t = 0; t < _timer_classes; t++) {
+            if (hardware->total[t][hardware_cycles] == 0) {
+                continue;
+            }
+            if (!first) {
+                f << ",";
+            }
+            first = false;
+            f << "\"" << timer_class_names[t] << "\": {";
+            for (int i = 0; i < _hardware_events; i++) {
+                if (i > 0) {
+                    f << ",";
+                }
+                f << "\"" << hardware_event_names[i] << "\": " << hardware->total[t][i];
+            }
+            f << "}";
+        }
+        f << "}";
+    }
     f << "}";
     f.flush();
     #endif
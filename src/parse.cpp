@@ -14,7 +14,21 @@
 // --prune
 // --iterations 1234567
 // --checkpoint-interval 65536
-// --x 3
+// --restart
+// --x 3 (or 3,5,7 to burn a batch of starting values at once)
+// --pool-allocator
+// --topology host (or a file written by the latencies tool)
+// --cache /scratch/hydra (directory for precomputed powers)
+// --lazy-carries 4 (carries go left every 4 steps)
+// --funnel-arity 4,2 (sub-funnels per funnel, by block level)
+// --dump hydra.bin (the whole integer, written at the end)
+// --load hydra.bin (start from a dump)
+// --helpers 2 (extra ranks sharing the top segment's products, 3^d-1 of them)
+// --help-from 20 (log size of the smallest power worth sharing)
+// --segments-per-rank 4 (chain segments per rank, taking turns while they wait)
+// --dormant (high segments sleep until the integer grows into them)
+// --hardware-counters (perf_event_open counters per timer, Linux only)
+// --profile-funnel (multiplications and splits per block and step size)
 // special iterations should be automatically determined
 
 static struct option longopts[] = {
@@ -22,7 +36,21 @@ static struct option longopts[] = {
     { "prune",                  no_argument,        NULL, 'p' },
     { "iterations",             required_argument,  NULL, 'n' },
     { "checkpoint-interval",    required_argument,  NULL, 'i' },
+    { "restart",                no_argument,        NULL, 'r' },
     { "x",                      required_argument,  NULL, 'x' },
+    { "pool-allocator",         no_argument,        NULL, 'a' },
+    { "topology",               required_argument,  NULL, 't' },
+    { "cache",                  required_argument,  NULL, 'k' },
+    { "lazy-carries",           required_argument,  NULL, 'l' },
+    { "funnel-arity",           required_argument,  NULL, 'f' },
+    { "dump",                   required_argument,  NULL, 'd' },
+    { "load",                   required_argument,  NULL, 'o' },
+    { "helpers",                required_argument,  NULL, 'g' },
+    { "help-from",              required_argument,  NULL, 'e' },
+    { "segments-per-rank",      required_argument,  NULL, 's' },
+    { "dormant",                no_argument,        NULL, 'w' },
+    { "hardware-counters",      no_argument,        NULL, 'u' },
+    { "profile-funnel",         no_argument,        NULL, 'v' },
     { NULL,                     0,                  NULL,  0  },
 };
 
@@ -74,6 +102,20 @@ void test_parse_config() {
         .global_block_max = 0,
         .prune_bits = 0,
         .checkpoint_interval = 0,
+        .restart = false,
+        .pool_allocator = false,
+        .topology = "",
+        .cache_dir = "",
+        .carry_interval = 1,
+        .funnel_arity = {},
+        .dump_file = "",
+        .load_file = "",
+        .helpers = 0,
+        .help_from = 20,
+        .segments_per_rank = 1,
+        .dormant = false,
+        .hardware_counters = false,
+        .profile_funnel = false,
     };
 
     parse_config(&config, (char*)"9-27,3-4/5-6");
@@ -87,8 +129,9 @@ void parse_args(problem_t* problem, config_t* config, int argc, char** argv) {
     bool config_set = false;
     bool iterations_set = false;
     bool checkpoint_set = false;
+    bool lazy_set = false;
     int ch;
-    while((ch = getopt_long_only(argc, argv, "c:pn:i:x:", longopts, NULL)) != -1) {
+    while((ch = getopt_long_only(argc, argv, "c:pn:i:rx:at:k:l:f:d:o:g:e:s:wuv", longopts, NULL)) != -1) {
         switch (ch) {
         case 'c':
             parse_config(config, optarg);
@@ -111,13 +154,71 @@ void parse_args(problem_t* problem, config_t* config, int argc, char** argv) {
             }
             checkpoint_set = true;
             break;
+        case 'r':
+            config->restart = true;
+            break;
         case 'x':
             {
-                const uint64_t x = std::strtoull(optarg, nullptr, 10);
-                problem->initial = x;
+                char* end;
+                problem->initial = std::strtoull(optarg, &end, 10);
+                problem->batch.clear();
+                while (*end == ',') {
+                    char* ptr = end+1;
+                    problem->batch.push_back(std::strtoull(ptr, &end, 10));
+                }
             }
             x_set = true;
             break;
+        case 'a':
+            config->pool_allocator = true;
+            break;
+        case 't':
+            config->topology = optarg;
+            break;
+        case 'k':
+            config->cache_dir = optarg;
+            break;
+        case 'l':
+            config->carry_interval = std::strtoull(optarg, nullptr, 10);
+            lazy_set = true;
+            break;
+        case 'f':
+            {
+                char* ptr = optarg;
+                while (*ptr != 0) {
+                    char* end;
+                    const uint64_t arity = std::strtoull(ptr, &end, 10);
+                    // garbage becomes an arity of 0, which is rejected later
+                    config->funnel_arity.push_back(end == ptr ? 0 : arity);
+                    if (end == ptr) break;
+                    ptr = *end == ',' ? end+1 : end;
+                }
+            }
+            break;
+        case 'd':
+            config->dump_file = optarg;
+            break;
+        case 'o':
+            config->load_file = optarg;
+            break;
+        case 'g':
+            config->helpers = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'e':
+            config->help_from = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 's':
+            config->segments_per_rank = std::strtoull(optarg, nullptr, 10);
+            break;
+        case 'w':
+            config->dormant = true;
+            break;
+        case 'u':
+            config->hardware_counters = true;
+            break;
+        case 'v':
+            config->profile_funnel = true;
+            break;
         case 0:
             fprintf(stderr, "arg parse discovered null argument\n");
             break;
@@ -125,6 +226,7 @@ void parse_args(problem_t* problem, config_t* config, int argc, char** argv) {
     }
     if (!x_set) {
         problem->initial = 3;
+        problem->batch.clear();
     }
     if (!config_set) {
         fprintf(stderr, "burn_hydra requires a configuration string.\n");
@@ -135,6 +237,9 @@ void parse_args(problem_t* problem, config_t* config, int argc, char** argv) {
     if (!checkpoint_set) {
         config->checkpoint_interval = 0;
     }
+    if (!lazy_set) {
+        config->carry_interval = 1;
+    }
 }
 
 void test_parse_args() {
@@ -146,13 +251,28 @@ void test_parse_args() {
         .global_block_max = 0,
         .prune_bits = 0,
         .checkpoint_interval = 0,
+        .restart = false,
+        .pool_allocator = false,
+        .topology = "",
+        .cache_dir = "",
+        .carry_interval = 1,
+        .funnel_arity = {},
+        .dump_file = "",
+        .load_file = "",
+        .helpers = 0,
+        .help_from = 20,
+        .segments_per_rank = 1,
+        .dormant = false,
+        .hardware_counters = false,
+        .profile_funnel = false,
     };
     // These (char*) casts are doing a lot of heavy lifting. Hopefully
     // getopt doesn't modify them.
-    std::vector<char*> vec = { NULL, (char*)"--config=9-27,3-4/5-6", (char*)"--prune", (char*)"--iterations", (char*)"420", (char*)"--checkpoint-interval", (char*)"39", (char*)"--x", (char*)"5" };
+    std::vector<char*> vec = { NULL, (char*)"--config=9-27,3-4/5-6", (char*)"--prune", (char*)"--iterations", (char*)"420", (char*)"--checkpoint-interval", (char*)"39", (char*)"--x", (char*)"5,7,9", (char*)"--topology", (char*)"host", (char*)"--pool-allocator", (char*)"--restart", (char*)"--cache", (char*)"/tmp", (char*)"--lazy-carries", (char*)"4", (char*)"--funnel-arity", (char*)"8,2", (char*)"--dump", (char*)"/tmp/a.bin", (char*)"--load", (char*)"/tmp/b.bin", (char*)"--helpers", (char*)"8", (char*)"--help-from", (char*)"24", (char*)"--segments-per-rank", (char*)"4", (char*)"--dormant", (char*)"--hardware-counters", (char*)"--profile-funnel" };
     char** argv = &vec[0];
-    parse_args(&problem, &config, 9, argv);
+    parse_args(&problem, &config, 32, argv);
     assert(problem.initial == 5);
+    assert(std::vector<uint64_t>({7, 9}) == problem.batch);
     assert(problem.iterations == 420);
 
     assert(std::vector<std::vector<uint64_t>>({{9, 27}, {3, 4}}) == config.block_sizes_funnel);
@@ -161,6 +281,20 @@ void test_parse_args() {
 
     assert(config.prune_bits == true);
     assert(config.checkpoint_interval == 39);
+    assert(config.topology == "host");
+    assert(config.pool_allocator == true);
+    assert(config.restart == true);
+    assert(config.cache_dir == "/tmp");
+    assert(config.carry_interval == 4);
+    assert(std::vector<uint64_t>({8, 2}) == config.funnel_arity);
+    assert(config.dump_file == "/tmp/a.bin");
+    assert(config.load_file == "/tmp/b.bin");
+    assert(config.helpers == 8);
+    assert(config.help_from == 24);
+    assert(config.segments_per_rank == 4);
+    assert(config.dormant == true);
+    assert(config.hardware_counters == true);
+    assert(config.profile_funnel == true);
 
     config = {
         .block_sizes_funnel = {},
@@ -169,6 +303,20 @@ void test_parse_args() {
         .global_block_max = 0,
         .prune_bits = 0,
         .checkpoint_interval = 0,
+        .restart = false,
+        .pool_allocator = false,
+        .topology = "",
+        .cache_dir = "",
+        .carry_interval = 1,
+        .funnel_arity = {},
+        .dump_file = "",
+        .load_file = "",
+        .helpers = 0,
+        .help_from = 20,
+        .segments_per_rank = 1,
+        .dormant = false,
+        .hardware_counters = false,
+        .profile_funnel = false,
     };
     // apparently -c= does not work, but abbreviations in general do
     vec = { NULL, (char*)"-c", (char*)"9-27,3-4/5-6", (char*)"-p", (char*)"-n", (char*)"420", (char*)"-i", (char*)"39", (char*)"-x", (char*)"5" };
@@ -180,6 +328,7 @@ void test_parse_args() {
     // skip over the -x
     parse_args(&problem, &config, 8, argv);
     assert(problem.initial == 3);
+    assert(problem.batch.empty());
     assert(problem.iterations == 420);
 
     assert(std::vector<std::vector<uint64_t>>({{9, 27}, {3, 4}}) == config.block_sizes_funnel);
@@ -188,5 +337,18 @@ void test_parse_args() {
 
     assert(config.prune_bits == true);
     assert(config.checkpoint_interval == 39);
+    assert(config.topology.empty());
+    assert(config.pool_allocator == false);
+    assert(config.restart == false);
+    assert(config.cache_dir.empty());
+    assert(config.carry_interval == 1);
+    assert(config.funnel_arity.empty());
+    assert(config.dump_file.empty());
+    assert(config.load_file.empty());
+    assert(config.helpers == 0);
+    assert(config.help_from == 20);
+    assert(config.segments_per_rank == 1);
+    assert(config.dormant == false);
+    assert(config.hardware_counters == false);
+    assert(config.profile_funnel == false);
 }
-
@@ -0,0 +1,277 @@
+#include <gmp.h>
+#include <flint/flint.h>
+#include <flint/fmpz.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "precompute.h"
+#include "segment.h"
+#include "metrics.h"
+
+// File layout, in native byte order:
+//  magic, version, limb bits, entry count,
+//  then per entry: byte offset of its limbs, limb count,
+//  then the limbs of every entry, back to back.
+// A layout change bumps the version, which is also part of the file
+// name, so stale caches are simply not found.
+const uint64_t precompute_magic = 0x4333504152445948; // "HYDRAP3C"
+const uint64_t precompute_version = 1;
+
+typedef struct precompute_header {
+    uint64_t magic;
+    uint64_t version;
+    uint64_t limb_bits;
+    uint64_t count;
+} precompute_header_t;
+
+typedef struct precompute_entry {
+    uint64_t offset;
+    uint64_t limbs;
+} precompute_entry_t;
+
+std::string precompute_filename(const std::string& dir) {
+    return dir + "/p3-v" + std::to_string(precompute_version) + ".bin";
+}
+
+// Small powers live inline, like FLINT would keep them.
+fmpz as_fmpz(__mpz_struct* z) {
+    if (mpz_cmp_ui(z, COEFF_MAX) <= 0) {
+        return static_cast<fmpz>(mpz_get_ui(z));
+    }
+    return PTR_TO_COEFF(z);
+}
+
+void publish(precompute_t* pre, uint64_t i) {
+    (*pre->p3)[i] = as_fmpz(&pre->powers[i]);
+    {
+        std::lock_guard<std::mutex> guard(pre->lock);
+        pre->ready.store(i+1, std::memory_order_release);
+    }
+    pre->filled.notify_all();
+}
+
+// Maps as many leading entries as the file has, up to `count`.
+// Returns how many were mapped; a missing or foreign file maps nothing.
+uint64_t map_cache(precompute_t* pre, uint64_t count) {
+    const std::string filename = precompute_filename(pre->cache_dir);
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    const bool sized = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(precompute_header_t);
+    void* map = sized ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    const size_t bytes = st.st_size;
+    const char* base = static_cast<const char*>(map);
+    const precompute_header_t* header = reinterpret_cast<const precompute_header_t*>(base);
+    const precompute_entry_t* entries = reinterpret_cast<const precompute_entry_t*>(header + 1);
+    bool ok = header->magic == precompute_magic
+        && header->version == precompute_version
+        && header->limb_bits == GMP_NUMB_BITS
+        && header->count <= (bytes - sizeof(*header)) / sizeof(*entries);
+    const uint64_t n = ok ? std::min(header->count, count) : 0;
+    for (uint64_t i = 0; ok && i < n; i++) {
+        ok = entries[i].limbs > 0
+            && entries[i].offset % sizeof(mp_limb_t) == 0
+            && entries[i].offset <= bytes
+            && entries[i].limbs <= (bytes - entries[i].offset) / sizeof(mp_limb_t);
+    }
+    if (!ok || n == 0) {
+        munmap(map, bytes);
+        return 0;
+    }
+    for (uint64_t i = 0; i < n; i++) {
+        // GMP only reads through these, the pages are read-only anyway
+        __mpz_struct* z = &pre->powers[i];
+        z->_mp_alloc = static_cast<int>(entries[i].limbs);
+        z->_mp_size = static_cast<int>(entries[i].limbs);
+        z->_mp_d = reinterpret_cast<mp_limb_t*>(const_cast<char*>(base + entries[i].offset));
+        (*pre->p3)[i] = as_fmpz(z);
+    }
+    pre->mapping = map;
+    pre->mapping_bytes = bytes;
+    return n;
+}
+
+uint64_t cached_count(const std::string& filename) {
+    precompute_header_t header = {};
+    FILE* f = fopen(filename.c_str(), "rb");
+    if (f == nullptr) {
+        return 0;
+    }
+    const bool ok = fread(&header, sizeof(header), 1, f) == 1;
+    fclose(f);
+    const bool ours = ok && header.magic == precompute_magic && header.version == precompute_version;
+    return ours ? header.count : 0;
+}
+
+// Written next to the final name and renamed, so concurrent ranks
+// on one node never see a partial file. Ranks with fewer blocks
+// leave a longer file from a wider rank alone.
+void write_cache(precompute_t* pre, uint64_t count) {
+    const std::string filename = precompute_filename(pre->cache_dir);
+    if (cached_count(filename) >= count) {
+        return;
+    }
+    const std::string partial = filename + "." + std::to_string(getpid()) + ".partial";
+    FILE* f = fopen(partial.c_str(), "wb");
+    if (f == nullptr) {
+        fprintf(stderr, "Could not write precompute cache %s.\n", partial.c_str());
+        return;
+    }
+    const precompute_header_t header = {
+        .magic = precompute_magic,
+        .version = precompute_version,
+        .limb_bits = GMP_NUMB_BITS,
+        .count = count,
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t offset = sizeof(header) + count * sizeof(precompute_entry_t);
+    for (uint64_t i = 0; i < count; i++) {
+        const precompute_entry_t entry = {
+            .offset = offset,
+            .limbs = mpz_size(&pre->powers[i]),
+        };
+        ok = ok && fwrite(&entry, sizeof(entry), 1, f) == 1;
+        offset += entry.limbs * sizeof(mp_limb_t);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        const size_t limbs = mpz_size(&pre->powers[i]);
+        ok = ok && fwrite(mpz_limbs_read(&pre->powers[i]), sizeof(mp_limb_t), limbs, f) == limbs;
+    }
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(partial.c_str(), filename.c_str()) == 0;
+    if (!ok) {
+        fprintf(stderr, "Could not write precompute cache %s.\n", filename.c_str());
+        remove(partial.c_str());
+    }
+}
+
+// Squares up the entries the cache didn't have. Uses plain GMP so no
+// FLINT state is touched off the main thread.
+void fill(precompute_t* pre, uint64_t count) {
+    uint64_t i = pre->mapped;
+    for (; i < count && !pre->stop.load(std::memory_order_relaxed); i++) {
+        __mpz_struct* z = &pre->powers[i];
+        if (i == 0) {
+            // 3^(2^0) = 3^1 = 3 is the first element of p3
+            mpz_init_set_ui(z, 3);
+        } else {
+            mpz_init(z);
+            mpz_mul(z, &pre->powers[i-1], &pre->powers[i-1]);
+        }
+        publish(pre, i);
+    }
+    if (i == count && !pre->cache_dir.empty()) {
+        write_cache(pre, count);
+    }
+}
+
+precompute_t* precompute_start(std::vector<fmpz>* p3, uint64_t count, const std::string& cache_dir) {
+    assert(count > 0);
+    precompute_t* pre = new precompute_t();
+    pre->p3 = p3;
+    pre->p3->assign(count, 0);
+    pre->powers.resize(count);
+    pre->ready = 0;
+    pre->stop = false;
+    pre->mapped = 0;
+    pre->mapping = nullptr;
+    pre->mapping_bytes = 0;
+    pre->cache_dir = cache_dir;
+    if (!cache_dir.empty()) {
+        pre->mapped = map_cache(pre, count);
+        pre->ready = pre->mapped;
+    }
+    if (pre->mapped < count) {
+        pre->filler = std::thread(fill, pre, count);
+    }
+    return pre;
+}
+
+void precompute_wait(precompute_t* pre, uint64_t e) {
+    std::unique_lock<std::mutex> guard(pre->lock);
+    pre->filled.wait(guard, [&] { return pre->ready.load(std::memory_order_acquire) > e; });
+}
+
+void precompute_stop(precompute_t* pre) {
+    pre->stop = true;
+    if (pre->filler.joinable()) {
+        pre->filler.join();
+    }
+    const uint64_t ready = pre->ready;
+    for (uint64_t i = 0; i < pre->p3->size(); i++) {
+        // views, not FLINT's to clear
+        (*pre->p3)[i] = 0;
+    }
+    for (uint64_t i = pre->mapped; i < ready; i++) {
+        mpz_clear(&pre->powers[i]);
+    }
+    if (pre->mapping != nullptr) {
+        munmap(pre->mapping, pre->mapping_bytes);
+    }
+    delete pre;
+}
+
+void precompute_init(data_t* data) {
+    vars_t* vars = data->vars;
+    // TODO: yes, inclusive
+    const uint64_t count = vars->block_size[0] + 1;
+    vars->precompute = precompute_start(&vars->p3, count, data->config->cache_dir);
+}
+
+const fmpz* power_of_3(data_t* data, uint64_t e) {
+    precompute_t* pre = data->vars->precompute;
+    if (pre->ready.load(std::memory_order_acquire) <= e) {
+        timer_start(data->metrics, waiting_powers);
+        precompute_wait(pre, e);
+        timer_stop(data->metrics, waiting_powers);
+    }
+    // the vector of whichever segment started it
+    return &(*pre->p3)[e];
+}
+
+void precompute_finalize(data_t* data) {
+    precompute_stop(data->vars->precompute);
+    data->vars->precompute = nullptr;
+}
+
+void test_precompute() {
+    char dir[] = "/tmp/hydra-precompute-XXXXXX";
+    const char* made = mkdtemp(dir);
+    assert(made != nullptr);
+    fmpz_t expected; fmpz_init(expected);
+    // computed, then partly mapped and extended, then fully mapped
+    const uint64_t counts[] = { 8, 10, 6 };
+    const uint64_t mapped[] = { 0, 8, 6 };
+    for (int run = 0; run < 3; run++) {
+        std::vector<fmpz> p3;
+        precompute_t* pre = precompute_start(&p3, counts[run], dir);
+        assert(pre->mapped == mapped[run]);
+        precompute_wait(pre, counts[run] - 1);
+        fmpz_set_ui(expected, 3);
+        for (uint64_t i = 0; i < counts[run]; i++) {
+            assert(fmpz_equal(&p3[i], expected));
+            fmpz_mul(expected, expected, expected);
+        }
+        precompute_stop(pre);
+    }
+    fmpz_clear(expected);
+    const int removed = remove(precompute_filename(dir).c_str());
+    assert(removed == 0);
+    const int removed_dir = rmdir(dir);
+    assert(removed_dir == 0);
+}
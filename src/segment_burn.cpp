@@ -1,6 +1,7 @@
 #include <gmp.h>
 #include <flint/flint.h>
 #include <flint/fmpz.h>
+#include <algorithm>
 #include <cstdlib>
 #include <cassert>
 #include <cstdint>
@@ -10,6 +11,10 @@
 #include "segment.h"
 #include "communicate.h"
 #include "metrics.h"
+#include "kernel.h"
+#include "precompute.h"
+#include "helpers.h"
+#include "blocks.h"
 
 // Largest power of 2 up to and including x.
 // https://stackoverflow.com/questions/4398711/round-to-the-nearest-power-of-two#4398845
@@ -27,12 +32,166 @@ uint64_t nearest2pow(uint64_t x) {
 }
 
 int segment_burn(data_t*, int);
-void recursive_burn(data_t*, fmpz_t, fmpz_t, uint64_t, int);
-void funnel_until(data_t*, fmpz_t, uint64_t, int);
-void basecase_burn(data_t*, fmpz_t, fmpz_t, uint64_t, int);
+void recursive_burn(data_t*, fmpz*, fmpz*, uint64_t, int);
+void funnel_until(data_t*, fmpz*, uint64_t, int);
+void basecase_burn(data_t*, fmpz_t, fmpz_t, uint64_t, int, uint64_t);
+
+// With --profile-funnel, the operations on block i, counted from the
+// top like block_size, go to the profile entry of its level from the
+// bottom and the step size.
+typedef struct profiled {
+    level_profile_t* entry;
+    start_time_t start;
+} profiled_t;
+
+profiled_t profile_start(data_t* data, int i, uint64_t e) {
+    level_profile_t* entry = profile_entry(data->metrics, data->vars->block_size.size()-1 - i, e);
+    return { .entry = entry, .start = entry != nullptr ? nanos() : start_time_t() };
+}
+
+void profile_stop(profiled_t profiled, profile_kind kind, uint64_t bits) {
+    if (profiled.entry != nullptr) {
+        profile_count(profiled.entry, kind, bits, profiled.start);
+    }
+}
+
+uint64_t lanes_bits(const fmpz* x, uint64_t lanes) {
+    uint64_t bits = 0;
+    for (uint64_t j = 0; j < lanes; j++) {
+        bits += fmpz_bits(&x[j]);
+    }
+    return bits;
+}
+
+// The kernels with y = p3[e], unless the product goes to the helpers,
+// for block i.
+void mul_split_p3(data_t* data, int i, fmpz_t high, fmpz_t low, const fmpz_t x, uint64_t e, const fmpz_t add, flint_bitcnt_t bits) {
+    const profiled_t mul = profile_start(data, i, e);
+    // x may be high
+    const uint64_t operands = mul.entry != nullptr ? fmpz_bits(x) + fmpz_bits(power_of_3(data, e)) : 0;
+    if (!helped(data, e)) {
+        mul_split(high, low, x, power_of_3(data, e), add, bits);
+    } else {
+        helped_mul(data, low, x, e);
+        fmpz_fdiv_q_2exp(high, low, bits);
+        fmpz_add(high, high, add);
+        fmpz_fdiv_r_2exp(low, low, bits);
+    }
+    profile_stop(mul, profile_multiply, operands);
+}
+
+void mul_add_p3(data_t* data, int i, fmpz_t x, uint64_t e, const fmpz_t add, flint_bitcnt_t from) {
+    const profiled_t mul = profile_start(data, i, e);
+    const uint64_t operands = mul.entry != nullptr ? fmpz_bits(x) - std::min<uint64_t>(fmpz_bits(x), from) + fmpz_bits(power_of_3(data, e)) : 0;
+    if (!helped(data, e)) {
+        mul_add(x, power_of_3(data, e), add, from);
+    } else {
+        fmpz_fdiv_q_2exp(x, x, from);
+        helped_mul(data, x, x, e);
+        fmpz_add(x, x, add);
+    }
+    profile_stop(mul, profile_multiply, operands);
+}
+
+// Temporaries with one entry per lane.
+std::vector<fmpz> lanes_init(data_t* data) {
+    return std::vector<fmpz>(data->vars->lanes, 0);
+}
+
+void lanes_clear(std::vector<fmpz>* x) {
+    for (fmpz& a : *x) {
+        fmpz_clear(&a);
+    }
+}
+
+// The low part the left neighbor split off in the last step goes onto
+// stored[0] only now. The neighbor sends it before waiting for ours,
+// so it's usually there already, and ours went out without waiting.
+// Anything reading the blocks between steps has to call this first.
+void segment_settle(data_t* data) {
+    transport_t* transport = data->transport;
+    if (!transport->left_due) {
+        return;
+    }
+    receiveLeftAdd(data, &data->vars->stored[0]);
+    finishSendLeft(data);
+    transport->left_due = false;
+}
+
+// H(n) <= 3n/2, so H^i(x) has at most bits(x) + i*log2(3/2) bits, and
+// log2(3/2) < 0.585.
+uint64_t reach_bits(const problem_t* problem, uint64_t iterations) {
+    uint64_t x = problem->initial;
+    for (const uint64_t y : problem->batch) {
+        x = std::max(x, y);
+    }
+    const uint64_t bits = 64 - __builtin_clzll(x | 1);
+    return bits + (iterations*585 + 999)/1000;
+}
+
+// With --dormant, a segment whose blocks the integer can't reach by the
+// end of the step has nothing but zeros to multiply and pass on, so it
+// skips the step and its right neighbor acts as the top segment. All
+// segments decide per step of the largest block, which every step of
+// theirs divides: the two ends of a link agree, a segment never wakes
+// above a dormant one, and neither ever goes back to sleep.
+void segment_wake(data_t* data, int64_t iterations) {
+    vars_t* vars = data->vars;
+    if (!data->config->dormant) {
+        return;
+    }
+    const uint64_t window = (uint64_t)1<<data->config->global_block_max;
+    const uint64_t reach = reach_bits(data->problem, (iterations/window + 1)*window);
+    const uint64_t left_offset = vars->global_offset[0] + ((uint64_t)1<<vars->block_size[0]);
+    vars->dormant = reach <= vars->global_offset[vars->global_offset.size()-1];
+    vars->left_dormant = !data->segment->is_top_segment && reach <= left_offset;
+}
+
+// The top segment has nowhere to send its overflow. Instead of letting
+// its top block widen without end, it stacks a block of the same size
+// on top as soon as the overflow spills past the block. Chain blocks all
+// have that size, so the chain just carries on inside the top segment,
+// and no single multiplication grows with the integer. A top block many
+// widths too wide, as checkpoints, dumps and long stretches of lazy
+// carries leave it, gets all its blocks at once.
+static bool top_spills(const vars_t* vars) {
+    const uint64_t width = (uint64_t)1<<vars->block_size[0];
+    for (uint64_t j = 0; j < vars->lanes; j++) {
+        if (fmpz_bits(&vars->stored[j]) > width) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One block of the top block's size, split off its bottom.
+static void grow_top_block(data_t* data) {
+    vars_t* vars = data->vars;
+    const uint64_t lanes = vars->lanes;
+    const uint64_t width = (uint64_t)1<<vars->block_size[0];
+    std::vector<fmpz> above = lanes_init(data);
+    for (uint64_t j = 0; j < lanes; j++) {
+        split_2exp(&above[j], &vars->stored[j], &vars->stored[j], width);
+    }
+    // the new blocks own what above held
+    vars->stored.insert(vars->stored.begin(), above.begin(), above.end());
+    vars->tmp.insert(vars->tmp.begin(), lanes, 0);
+    vars->global_offset.insert(vars->global_offset.begin(), vars->global_offset[0] + width);
+    vars->block_size.insert(vars->block_size.begin(), vars->block_size[0]);
+    // nothing funnels between blocks of the same size, call it binary
+    vars->funnel_bits.insert(vars->funnel_bits.begin(), 1);
+    counter_count(data->metrics, top_blocks_grown);
+}
+
+void grow_top(data_t* data) {
+    while (top_spills(data->vars)) {
+        grow_top_block(data);
+    }
+}
 
 // Returns number of iterations actually completed.
 int segment_burn(data_t* data, int64_t max_iterations) {
+    segment_settle(data);
     uint64_t e = nearest2pow(static_cast<uint64_t>(max_iterations)); // log iterations
     uint64_t l = data->vars->block_size[0]; // log size
     // iterations can't exceed size because that causes problems
@@ -46,39 +205,53 @@ int segment_burn(data_t* data, int64_t max_iterations) {
     }
     segment_t* segment = data->segment;
     vars_t* vars = data->vars;
+    if (vars->dormant) {
+        counter_count(data->metrics, steps_dormant);
+        return (uint64_t)1<<e;
+    }
 
     // TODO: this is also part of the left-truncation condition.
     // When the result leaves the segment's light cone, it should
     // be able to simply disappear.
     // Currently, just a crude approximation so that we use finite space.
-    bool dont_communicate_left = segment->is_top_segment;
+    bool dont_communicate_left = segment->is_top_segment || vars->left_dormant;
 
-    fmpz* update = &vars->update;
+    const uint64_t lanes = vars->lanes;
+    fmpz* update = &vars->update[0];
     // TODO: again, rop and add parameters could be merged
-    fmpz_t output; fmpz_init(output);
+    std::vector<fmpz> output = lanes_init(data);
     // Note that this timer is paused at the leaf cases.
     timer_start(data->metrics, grinding_chain);
-    recursive_burn(data, output, update, e, 0);
+    burn_blocks(data, &output[0], update, e);
     timer_stop(data->metrics, grinding_chain);
 
+    // With lazy carries, the overflow mostly stays on the block like
+    // it does on the top segment. The block then multiplies a bit
+    // wider, but the left neighbor doesn't wait for us in between.
+    const bool carry_left = !dont_communicate_left && carry_due(data, &data->transport->left);
     // lower node sends first (to cleanup memory for lower levels (!?))
-    if (!dont_communicate_left) {
+    if (carry_left) {
+        for (uint64_t j = 0; j < lanes; j++) {
+            // the inboxes are sized for this much overflow
+            assert(fmpz_bits(&output[j]) <= (data->config->carry_interval+1)<<l);
+        }
         // gmp_printf("%d      sent left: %d bits\n", segment->world_rank, fmpz_sizeinbase(output, 2));
-        sendLeft(data, output);
+        startSendLeft(data, &output[0]);
     } else {
-        fmpz_mul_2exp(update, output, (uint64_t)1<<l);
-    }
-    fmpz_clear(output);
-
-    if (!dont_communicate_left) {
-        receiveLeft(data, update);
-        // gmp_printf("%d  received left: %d bits\n", segment->world_rank, fmpz_sizeinbase(output, 2));
+        for (uint64_t j = 0; j < lanes; j++) {
+            add_2exp(&vars->stored[j], &output[j], (uint64_t)1<<l);
+            fmpz_set_ui(&update[j], 0);
+        }
+        if (segment->is_top_segment) {
+            grow_top(data);
+        }
     }
-
-    // Problem... why is this now happening _before_ the computation,
-    // while the recursive-burn's addition happens after?
-    fmpz_add(&data->vars->stored[0], &data->vars->stored[0], update);
-    fmpz_set_ui(update, 0);
+    lanes_clear(&output);
+    // the low part from the left comes every step, it's received by
+    // the next segment_settle
+    data->transport->left_due = !dont_communicate_left;
+    blocks_check(data);
+    blocks_reserve(data);
 
     // compensating for small shifts is not necessary as long
     // as they remain in sync
@@ -88,61 +261,158 @@ int segment_burn(data_t* data, int64_t max_iterations) {
 }
 
 void segment_finalize(data_t* data) {
+    segment_settle(data);
     // If (when) the segment didn't send its update, it needs
     // to re-inflate it and add it onto itself.
     const uint64_t l = data->vars->block_size[0]; // log size
-    fmpz* update = &data->vars->update;
-    fmpz* stored = &data->vars->stored[0];
-    if (!data->segment->is_top_segment) {
-        fmpz_mul_2exp(update, update, (uint64_t)1<<l);
+    for (uint64_t j = 0; j < data->vars->lanes; j++) {
+        fmpz* update = &data->vars->update[j];
+        fmpz* stored = &data->vars->stored[j];
+        add_2exp(stored, update, data->segment->is_top_segment ? 0 : (uint64_t)1<<l);
+    }
+}
+
+// Adds the undercarry, if any, onto block i of 2^l bits, and the carry
+// out of it goes to rop, per lane.
+void split_block(data_t* data, fmpz* rop, fmpz* stored, const fmpz* add, uint64_t l, int i, uint64_t e) {
+    const uint64_t lanes = data->vars->lanes;
+    const profiled_t split = profile_start(data, i, e);
+    const uint64_t operands = split.entry != nullptr ? lanes_bits(stored, lanes) : 0;
+    for (uint64_t j = 0; j < lanes; j++) {
+        if (add != nullptr) {
+            fmpz_add(&stored[j], &stored[j], &add[j]);
+        }
+        split_2exp(&rop[j], &stored[j], &stored[j], (uint64_t)1<<l);
+    }
+    profile_stop(split, profile_split, operands);
+}
+
+// The bottom block i of the segment: the basecase on the base segment,
+// otherwise the exchange with the right neighbor.
+void leaf_burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e, int i) {
+    const uint64_t lanes = data->vars->lanes;
+    fmpz* stored = &data->vars->stored[i*lanes];
+    fmpz* tmp = &data->vars->tmp[i*lanes];
+    // Therefore we have the right size to pass to the next node.
+    uint64_t t = (uint64_t)1<<e;
+    if (data->segment->is_base_segment) {
+        // Time to iterate basecase.
+        // This function handles everything it needs already.
+        // TODO: basecase_burn handles way too much, why, how?
+        // TODO: store this
+        timer_stop(data->metrics, grinding_chain);
+        timer_start(data->metrics, grinding_basecase);
+        for (uint64_t j = 0; j < lanes; j++) {
+            fmpz_t ret; fmpz_init(ret);
+            basecase_burn(data, ret, &add[j], e, i, j);
+            fmpz_set(&rop[j], ret);
+            fmpz_clear(ret);
+        }
+        timer_stop(data->metrics, grinding_basecase);
+        timer_start(data->metrics, grinding_chain);
+        return;
+    }
+    // Otherwise continue passing data forth. The undercarry
+    // lands on the high part, so it's added during the split.
+    for (uint64_t j = 0; j < lanes; j++) {
+        mul_split_p3(data, i, &stored[j], &tmp[j], &stored[j], e, &add[j], t);
+    }
+    timer_stop(data->metrics, grinding_chain);
+    // tmp doesn't depend on the carry from the right, so it
+    // goes first and the right neighbor never waits on us
+    sendRight(data, tmp);
+    // gmp_printf("%d      sent right: %d bits\n", segment->world_rank, fmpz_sizeinbase(tmp, 2));
+    // tmp is already split off, so the carry goes right onto stored
+    if (carry_due(data, &data->transport->right)) {
+        const bool nonempty = receiveRightAdd(data, stored);
+        // gmp_printf("%d  received right: %d bits\n", segment->world_rank, fmpz_sizeinbase(ret, 2));
+        counter_count(data->metrics, messages_received_right);
+        if (nonempty) {
+            counter_count(data->metrics, messages_received_right_nonempty);
+        }
     }
-    fmpz_add(stored, stored, update);
+    timer_start(data->metrics, grinding_chain);
+    split_block(data, rop, stored, nullptr, data->vars->block_size[i], i, e);
 }
 
 // Funnel until next block, denoted by index i
 // Updates x, representing the entire right side of the integer.
-void funnel_until(data_t* data, fmpz_t x, uint64_t e, int i) {
-    const uint64_t end_size = data->vars->block_size[i];
+// x has one entry per lane.
+// The block is a policy with its index, its log size and the
+// recursive_burn to run on it, so that the fixed layout's funnels are
+// this same code with all of them known at compile time.
+template <typename block> void funnel_with(data_t* data, fmpz* x, uint64_t e, block to) {
+    const int i = to.index();
+    const uint64_t end_size = to.size(data);
+    const uint64_t lanes = data->vars->lanes;
     assert(e >= end_size);
-    std::vector<fmpz> p3 = data->vars->p3;
     if (e == end_size) {
         // x *= p3t
         // return top(x) + recv_carry(tail(x))
-        fmpz_mul(x, x, &p3[e]);
-        fmpz_t tmp2; fmpz_init(tmp2);
-        fmpz_fdiv_r_2exp(tmp2, x, (uint64_t)1<<e);
-        fmpz_fdiv_q_2exp(x, x, (uint64_t)1<<e);
-        fmpz_t res; fmpz_init(res);
-        recursive_burn(data, res, tmp2, e, i);
-        fmpz_clear(tmp2);
+        // The block above isn't a leaf, so its tmp is free for the low
+        // part, and x trades limbs with it.
+        fmpz* tmp2 = &data->vars->tmp[(i-1)*lanes];
+        const fmpz zero = 0;
+        for (uint64_t j = 0; j < lanes; j++) {
+            mul_split_p3(data, i, &x[j], &tmp2[j], &x[j], e, &zero, (uint64_t)1<<e);
+        }
+        std::vector<fmpz> res = lanes_init(data);
+        to.burn(data, &res[0], tmp2, e);
         // TODO: ideally no allocate or deallocate of mpz_t
         // Technically, we could pass the same mpz into both...
         // they're never needed at the same time
-        fmpz_add(x, x, res);
-        fmpz_clear(res);
+        const profiled_t add = profile_start(data, i, e);
+        const uint64_t operands = add.entry != nullptr ? lanes_bits(&x[0], lanes) : 0;
+        for (uint64_t j = 0; j < lanes; j++) {
+            fmpz_add(&x[j], &x[j], &res[j]);
+        }
+        profile_stop(add, profile_split, operands);
+        lanes_clear(&res);
     } else {
         // e > end_size
+        // 2^b sub-funnels of 2^f iterations each. Wider funnels keep
+        // smaller lows on the stack, but multiply x more often.
+        const uint64_t b = std::min(data->vars->funnel_bits[i], e - end_size);
+        const uint64_t f = e - b;
         // TODO: preallocate this
-        fmpz_t next; fmpz_init(next);
+        std::vector<fmpz> next = lanes_init(data);
         // high, one low per stack
-        // high is n/2, low is actually n*1.6
-        uint64_t t = (uint64_t)1<<(e-1);
-        fmpz_set(next, x);
-        for (int j = 0; j < 2; j++) {
-            fmpz_fdiv_r_2exp(next, x, t);
-            fmpz_fdiv_q_2exp(x, x, t);
+        // high is n/2^b, low is actually n*1.6/2^b
+        uint64_t t = (uint64_t)1<<f;
+        for (uint64_t k = 0; k < ((uint64_t)1<<b); k++) {
+            const profiled_t split = profile_start(data, i, e);
+            const uint64_t operands = split.entry != nullptr ? lanes_bits(&x[0], lanes) : 0;
+            // Only the low part is copied out. The high part stays in
+            // place, and the multiplication reads it through a slice.
+            for (uint64_t j = 0; j < lanes; j++) {
+                fmpz_fdiv_r_2exp(&next[j], &x[j], t);
+            }
+            profile_stop(split, profile_split, operands);
             // most of the size thus remains in x
             // I guess they are both in cache though
-            funnel_until(data, next, e-1, i);
+            funnel_with(data, &next[0], f, to);
             // x re-inflates after the longer process
-            fmpz_mul(x, x, &p3[e-1]);
-            fmpz_add(x, x, next);
+            for (uint64_t j = 0; j < lanes; j++) {
+                mul_add_p3(data, i, &x[j], f, &next[j], t);
+            }
         }
-        fmpz_clear(next);
+        lanes_clear(&next);
     }
     // Return is handled by updating x.
 }
 
+// Block i of the segment's blocks as they are at run time.
+struct runtime_block {
+    int i;
+    int index() const { return i; }
+    uint64_t size(const data_t* data) const { return data->vars->block_size[i]; }
+    void burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e) const { recursive_burn(data, rop, add, e, i); }
+};
+
+void funnel_until(data_t* data, fmpz* x, uint64_t e, int i) {
+    funnel_with(data, x, e, runtime_block{ i });
+}
+
 // Recursive burn moves depth-first from left to right,
 //  possibly with some branching. Each i represents one block
 //  of memory, regardless of step size. Steps size adapts (by
@@ -162,64 +432,94 @@ void funnel_until(data_t* data, fmpz_t x, uint64_t e, int i) {
 // 4) Compute and return overcarry
 // Some carries inevitably have to be stored, but it may be possible to
 // delay the storage of the big ones.
-void recursive_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int i) {
-    segment_t* segment = data->segment;
-    std::vector<uint64_t> blocks = data->vars->block_size;
+// Every lane goes through each step together, so that the carries of
+// all lanes cross to the neighbors in the same message.
+void recursive_burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e, int i) {
+    // not a copy, the top segment can end up with many blocks
+    const std::vector<uint64_t>& blocks = data->vars->block_size;
+    const uint64_t lanes = data->vars->lanes;
     uint64_t l = blocks[i]; // log size of input/self
-    fmpz* stored = &data->vars->stored[i];
-    fmpz* tmp = &data->vars->tmp[i];
-    std::vector<fmpz> p3 = data->vars->p3;
+    fmpz* stored = &data->vars->stored[i*lanes];
     if (i == static_cast<int>(blocks.size()) - 1) {
-        // Therefore we have the right size to pass to the next node.
-        uint64_t t = (uint64_t)1<<e;
-        // TODO: store this
-        fmpz_t ret; fmpz_init(ret);
-        if (segment->is_base_segment) {
-            // Time to iterate basecase.
-            // This function handles everything it needs already.
-            // TODO: basecase_burn handles way too much, why, how?
-            timer_stop(data->metrics, grinding_chain);
-            timer_start(data->metrics, grinding_basecase);
-            basecase_burn(data, ret, add, e, i);
-            fmpz_set(rop, ret);
-            fmpz_clear(ret);
-            timer_stop(data->metrics, grinding_basecase);
-            timer_start(data->metrics, grinding_chain);
-            return;
-        } else {
-            // Otherwise continue passing data forth.
-            fmpz_mul(stored, stored, &p3[e]);
-            fmpz_fdiv_r_2exp(tmp, stored, t);
-            fmpz_fdiv_q_2exp(stored, stored, t);
-            timer_stop(data->metrics, grinding_chain);
-            receiveRight(data, ret);
-            // gmp_printf("%d  received right: %d bits\n", segment->world_rank, fmpz_sizeinbase(ret, 2));
-            sendRight(data, tmp);
-            // gmp_printf("%d      sent right: %d bits\n", segment->world_rank, fmpz_sizeinbase(tmp, 2));
-            counter_count(data->metrics, messages_received_right);
-            if (fmpz_sgn(ret) != 0) {
-                counter_count(data->metrics, messages_received_right_nonempty);
-            }
-            timer_start(data->metrics, grinding_chain);
-            fmpz_add(stored, stored, ret);
+        leaf_burn(data, rop, add, e, i);
+        return;
+    }
+    funnel_until(data, stored, e, i+1);
+    split_block(data, rop, stored, add, l, i, e);
+}
+
+#ifdef HYDRA_FIXED_BLOCKS
+// A block layout built in with make FIXED_BLOCKS=12,12,12, bottom block
+// first like in the config. Segments with exactly these blocks recurse
+// through a call tree specialized per block, with every size and the
+// leaf known at compile time. Other segments, like the base segment's
+// funnel or a grown top segment, take the general path.
+constexpr uint64_t fixed_blocks[] = { HYDRA_FIXED_BLOCKS };
+constexpr int fixed_count = sizeof(fixed_blocks)/sizeof(fixed_blocks[0]);
+// top block first, like vars->block_size
+constexpr uint64_t fixed_block(int i) {
+    return fixed_blocks[fixed_count-1 - i];
+}
+
+constexpr bool fixed_blocks_grow() {
+    for (int i = 1; i < fixed_count; i++) {
+        if (fixed_blocks[i] < fixed_blocks[i-1]) {
+            return false;
         }
-        fmpz_clear(ret);
+    }
+    return true;
+}
+static_assert(fixed_blocks_grow(), "Decreasing block sizes are currently not supported.");
+
+bool fixed_layout(const vars_t* vars) {
+    if (vars->block_size.size() != static_cast<size_t>(fixed_count)) {
+        return false;
+    }
+    for (int i = 0; i < fixed_count; i++) {
+        if (vars->block_size[i] != fixed_block(i)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <int I> void fixed_recursive_burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e);
+
+// Block I of the fixed layout, for funnel_with.
+template <int I> struct fixed_block_at {
+    constexpr int index() const { return I; }
+    constexpr uint64_t size(const data_t*) const { return fixed_block(I); }
+    void burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e) const { fixed_recursive_burn<I>(data, rop, add, e); }
+};
+
+// recursive_burn, with block I's place in the layout known.
+template <int I> void fixed_recursive_burn(data_t* data, fmpz* rop, fmpz* add, uint64_t e) {
+    if constexpr (I == fixed_count-1) {
+        leaf_burn(data, rop, add, e, I);
     } else {
-        funnel_until(data, stored, e, i+1);
+        const uint64_t lanes = data->vars->lanes;
+        fmpz* stored = &data->vars->stored[I*lanes];
+        funnel_with(data, stored, e, fixed_block_at<I+1>{});
+        split_block(data, rop, stored, add, fixed_block(I), I, e);
     }
-    if (segment->world_rank == 1) {
-        
+}
+#endif // HYDRA_FIXED_BLOCKS
+
+// A whole step from the top block down, for segment_burn.
+void burn_blocks(data_t* data, fmpz* rop, fmpz* add, uint64_t e) {
+#ifdef HYDRA_FIXED_BLOCKS
+    if (fixed_layout(data->vars)) {
+        fixed_recursive_burn<0>(data, rop, add, e);
+        return;
     }
-    fmpz_add(stored, stored, add);
-    fmpz_fdiv_q_2exp(tmp, stored, (uint64_t)1<<l);
-    fmpz_fdiv_r_2exp(stored, stored, (uint64_t)1<<l);
-    fmpz_set(rop, tmp); // TODO: work with rop as scratch?
-    // note: that might reduce ram infighting with multiple threads
+#endif // HYDRA_FIXED_BLOCKS
+    recursive_burn(data, rop, add, e, 0);
 }
 
-void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block) {
-    fmpz* fstored = &data->vars->stored[block];
-    fmpz* ftmp = &data->vars->tmp[block];
+void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block, uint64_t lane) {
+    const uint64_t index = block*data->vars->lanes + lane;
+    fmpz* fstored = &data->vars->stored[index];
+    fmpz* ftmp = &data->vars->tmp[index];
     uint64_t l = data->vars->block_size[block];
     basecase_table_t* table = data->vars->basecase_table;
     uint64_t bits = data->vars->table_bits;
@@ -266,13 +566,14 @@ void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block)
 // the rest optimized for space
 // OR we could have it break on listed memory regions, more control
 
-// TODO: formalize mathematical description (k=1,2) for documentation
-// t = 1<<(e-1)
+// TODO: formalize mathematical description for documentation
+// With arity 2^b, since H^t(high*2^t + low) = high*3^t + H^t(low):
+// t = 1<<(e-b)
 // tmp = x
-// for i in {0,1}
+// for i in {0..2^b-1}
     // high = tmp >> t
     // low = tmp % 2^t
-    // tmp = (3^t)*high + burn_funnel(low, e)
+    // tmp = (3^t)*high + burn_funnel(low, e-b)
 
 // void burn_funnel(data_t* data, mpz_t x, uint64_t e, uint64_t l) {
     // high, one low per stack
@@ -286,3 +587,53 @@ void basecase_burn(data_t* data, fmpz_t rop, fmpz_t add, uint64_t e, int block)
     // return tmp
 // }
 
+
+// One base and top segment of blocks 2^10 and 2^5 bits, without MPI,
+// burning two lanes. Every arity has to land on the same numbers as
+// plain iteration. Built with FIXED_BLOCKS=5,10, this goes through the
+// fixed layout.
+void test_funnel_arity() {
+    const uint64_t lanes = 2;
+    data_t* data = lone_segment_init({10, 5}, lanes, 4);
+    vars_t& vars = *data->vars;
+    vars.precompute = precompute_start(&vars.p3, 11, "");
+    flint_rand_t rand;
+    flint_rand_init(rand);
+    fmpz n[lanes], expected[lanes], carry[lanes], zero[lanes];
+    fmpz_t got; fmpz_init(got);
+    for (uint64_t j = 0; j < lanes; j++) {
+        fmpz_init(&n[j]); fmpz_init(&expected[j]); fmpz_init(&carry[j]); fmpz_init(&zero[j]);
+        fmpz_randbits_unsigned(&n[j], rand, 1000);
+        fmpz_set(&expected[j], &n[j]);
+        for (int k = 0; k < 1<<10; k++) {
+            fmpz_t half; fmpz_init(half);
+            fmpz_fdiv_q_2exp(half, &expected[j], 1);
+            fmpz_add(&expected[j], &expected[j], half);
+            fmpz_clear(half);
+        }
+    }
+    // arity 64 is wider than the funnel, so it gets clamped
+    for (const uint64_t bits : { 1, 2, 3, 5, 6 }) {
+        vars.funnel_bits[1] = bits;
+        for (uint64_t j = 0; j < lanes; j++) {
+            fmpz_fdiv_q_2exp(&vars.stored[j], &n[j], 32);
+            fmpz_fdiv_r_2exp(&vars.stored[lanes + j], &n[j], 32);
+        }
+        timer_start(data->metrics, grinding_chain);
+        burn_blocks(data, carry, zero, 10);
+        timer_stop(data->metrics, grinding_chain);
+        for (uint64_t j = 0; j < lanes; j++) {
+            fmpz_mul_2exp(got, &carry[j], 1<<10);
+            fmpz_add(got, got, &vars.stored[j]);
+            fmpz_mul_2exp(got, got, 32);
+            fmpz_add(got, got, &vars.stored[lanes + j]);
+            assert(fmpz_equal(got, &expected[j]));
+        }
+    }
+    for (uint64_t j = 0; j < lanes; j++) {
+        fmpz_clear(&n[j]); fmpz_clear(&expected[j]); fmpz_clear(&carry[j]); fmpz_clear(&zero[j]);
+    }
+    fmpz_clear(got);
+    flint_rand_clear(rand);
+    lone_segment_clear(data);
+}
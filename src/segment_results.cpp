@@ -1,3 +1,4 @@
+#include <mpi.h>
 #include <gmp.h>
 #include <flint/flint.h>
 #include <flint/fmpz.h>
@@ -6,28 +7,34 @@
 
 #include "segment.h"
 #include "communicate.h"
+#include "fibers.h"
 
 void print_segment_blocks(data_t* data) {
     std::vector<fmpz> stored = data->vars->stored;
+    const int lanes = data->vars->lanes;
     int i;
-    for (i = stored.size()-1; i >= 0; i--) {
-        flint_printf("segment %d, block %d: %{fmpz}\n", data->segment->world_rank, i, &stored[i]); // TODO: ampersand or not?
+    for (i = stored.size()/lanes-1; i >= 0; i--) {
+        for (int j = 0; j < lanes; j++) {
+            flint_printf("segment %d, block %d, lane %d: %{fmpz}\n", data->segment->world_rank, i, j, &stored[i*lanes + j]); // TODO: ampersand or not?
+        }
     }
 }
 
+// Of the first lane.
 void print_smallest_mod(data_t* data, uint64_t mod) {
     fmpz_t a; fmpz_init(a);
-    uint64_t m = fmpz_mod_ui(a, &data->vars->stored[data->vars->stored.size()-1], mod);
+    uint64_t m = fmpz_mod_ui(a, &data->vars->stored[data->vars->stored.size()-data->vars->lanes], mod);
     std::cout << data->segment->world_rank << "'s smallest block mod " << mod << " is " << m << std::endl;
 }
 
 // Requires all segments to be on the same iteration.
 // TODO: assert the above
 // Requires all segments to use the same base.
-// Gathers residues mod base^exp from all nodes onto rank 0 to print.
-void print_signature(data_t* data, uint64_t base, uint64_t exp) {
+// Gathers residues mod base^exp from all nodes into rop on rank 0.
+void signature(data_t* data, uint64_t lane, uint64_t base, uint64_t exp, fmpz_t rop) {
     // timer
     const std::vector<fmpz> stored = data->vars->stored;
+    const uint64_t lanes = data->vars->lanes;
     const std::vector<uint64_t> global_offset = data->vars->global_offset;
 
     const int root = 0;
@@ -39,21 +46,32 @@ void print_signature(data_t* data, uint64_t base, uint64_t exp) {
 
     fmpz_ui_pow_ui(mod, base, exp);
 
-    const int count = stored.size();
+    const int count = global_offset.size();
     for (int i = 0; i < count; i++) {
         fmpz_powm_ui(scale, two, global_offset[i], mod);
-        fmpz_mod(tmp, &stored[i], mod);
+        fmpz_mod(tmp, &stored[i*lanes + lane], mod);
         fmpz_mul(tmp, tmp, scale);
         fmpz_add(res, res, tmp);
     }
     fmpz_mod(res, res, mod);
 
+    // the segments of a rank add up first, and the bottom one gathers
+    transport_t* transport = data->transport;
+    if (transport->fibers != nullptr && !fibers_sum(transport->fibers, res, transport->owns_mpi)) {
+        fmpz_clear(mod);
+        fmpz_clear(tmp);
+        fmpz_clear(res);
+        return;
+    }
+    int ranks;
+    MPI_Comm_size(transport->comm, &ranks);
+
     // TODO: check that this doesn't corrupt things again
     fmpz* buffer = nullptr;
     if (data->segment->world_rank == root) {
         // prepare buffer
-        buffer = (fmpz*) malloc(data->segment->world_size * sizeof(fmpz));
-        for (int i = 0; i < data->segment->world_size; i++) {
+        buffer = (fmpz*) malloc(ranks * sizeof(fmpz));
+        for (int i = 0; i < ranks; i++) {
             // fmpz's default to 0, then turn into pointers as needed
             fmpz_init(&buffer[i]);
             _fmpz_promote(&buffer[i]);
@@ -65,14 +83,12 @@ void print_signature(data_t* data, uint64_t base, uint64_t exp) {
     if (data->segment->world_rank == root) {
         // sum again
         fmpz_set_ui(res, 0);
-        for (int i = 0; i < data->segment->world_size; i++) {
+        for (int i = 0; i < ranks; i++) {
             fmpz_add(res, res, &buffer[i]);
             fmpz_clear(&buffer[i]);
         }
         free(buffer);
-        // fancy print :D
-        fmpz_mod(res, res, mod);
-        flint_printf("≡ %{fmpz} (mod %u^%u)", &res, base, exp);
+        fmpz_mod(rop, res, mod);
     }
 
     fmpz_clear(mod);
@@ -83,17 +99,22 @@ void print_signature(data_t* data, uint64_t base, uint64_t exp) {
 
 void print_special_2exp(data_t* data, int64_t e) {
     const segment_t* segment = data->segment;
-    if (segment->world_rank == 0) {
-        flint_printf("H^2^%d(%u) ", e, data->problem->initial);
-    }
-    // Note that this function must be called by every segment.
-    print_signature(data, 2, 128);
-    if (segment->world_rank == 0) {
-        flint_printf(" ");
-    }
-    print_signature(data, 3, 128);
-    if (segment->world_rank == 0) {
-        flint_printf("\n");
+    segment_settle(data);
+    // one line per lane, printed whole so that the other ranks' output
+    // can't land in the middle of it
+    fmpz_t mod2; fmpz_init(mod2);
+    fmpz_t mod3; fmpz_init(mod3);
+    for (uint64_t j = 0; j < data->vars->lanes; j++) {
+        const uint64_t x = j == 0 ? data->problem->initial : data->problem->batch[j-1];
+        // Note that this function must be called by every segment.
+        signature(data, j, 2, 128, mod2);
+        signature(data, j, 3, 128, mod3);
+        if (segment->world_rank == 0) {
+            flint_printf("H^2^%d(%u) ≡ %{fmpz} (mod 2^128) ≡ %{fmpz} (mod 3^128)\n", e, x, mod2, mod3);
+            fflush(stdout);
+        }
     }
+    fmpz_clear(mod2);
+    fmpz_clear(mod3);
 }
 
@@ -1,11 +1,16 @@
 #include <flint/flint.h>
 #include <flint/fmpz.h>
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <cassert>
 #include <vector>
 
 #include "segment.h"
+#include "communicate.h"
+#include "topology.h"
+#include "precompute.h"
+#include "helpers.h"
 #include "common.h"
 #include "metrics.h"
 #include "friendly_assert.h"
@@ -47,6 +52,24 @@ void constrain_config(data_t* data) {
     }
     friendly_concern(&any_error, data->problem->iterations % ((uint64_t)1<<*block_max) == 0, "Problem iterations currently may only be multiples of the largest block size.");
     friendly_concern(&any_error, data->config->block_sizes_used.size() == static_cast<size_t>(world_size), "internal: block sizes not correctly unrolled");
+    friendly_concern(&any_error, config->carry_interval >= 1, "Lazy carries need an interval of at least one step.");
+    const bool batched = data->problem->batch.size() > 0;
+    friendly_concern(&any_error, !batched || (config->checkpoint_interval == 0 && !config->restart), "Checkpoints don't support batches yet.");
+    const bool dumps = !config->dump_file.empty() || !config->load_file.empty();
+    friendly_concern(&any_error, !batched || !dumps, "Dumps don't support batches yet.");
+    friendly_concern(&any_error, !config->restart || config->load_file.empty(), "Start from either checkpoints or a dump, not both.");
+    friendly_concern(&any_error, config->helpers == 0 || helper_depth(config->helpers) > 0, "Helpers and the top segment have to make up 3^d ranks.");
+    friendly_concern(&any_error, config->helpers == 0 || config->topology.empty(), "Helpers don't support --topology yet.");
+    const bool fibers = config->segments_per_rank > 1;
+    friendly_concern(&any_error, !fibers || (config->topology.empty() && config->helpers == 0 && !dumps), "Several segments per rank don't support --topology, helpers or dumps yet.");
+    for (const auto& blocks : unrolled) {
+        for (const uint64_t size : blocks) {
+            friendly_concern(&any_error, !dumps || size >= 6, "Dumps need blocks of at least 2^6 bits.");
+        }
+    }
+    for (const uint64_t k : config->funnel_arity) {
+        friendly_concern(&any_error, k >= 2 && (k & (k-1)) == 0, "Funnel arities have to be powers of two.");
+    }
     if (any_error) {
         std::cerr << "Constraints not met." << std::endl;
         exit(1);
@@ -71,6 +94,69 @@ void init_table(vars_t* vars, uint64_t power) {
     }
 }
 
+data_t* lone_segment_init(const std::vector<uint64_t>& block_size, uint64_t lanes, uint64_t table_bits) {
+    problem_t* problem = new problem_t { .initial = 0, .iterations = 0, .batch = {} };
+    segment_t* segment = new segment_t { .world_size = 1, .world_rank = 0, .is_base_segment = true, .is_top_segment = true };
+    metrics_t* metrics = (metrics_t*) calloc(1, sizeof(metrics_t));
+    init_metrics(metrics, false);
+    vars_t* vars = new vars_t {
+        .update = {},
+        .p3 = {},
+        .tmp = {},
+        .stored = {},
+        .lanes = lanes,
+        .basecase_table = nullptr,
+        .p3base = 0,
+        .table_bits = 0,
+
+        .block_size = block_size,
+        .global_offset = {},
+        .funnel_bits = {},
+        .precompute = nullptr,
+        .dormant = false,
+        .left_dormant = false,
+    };
+    if (table_bits > 0) {
+        vars->basecase_table = (basecase_table_t*) malloc(((uint64_t)1<<table_bits) * sizeof(basecase_table_t));
+        init_table(vars, table_bits);
+    }
+    uint64_t offset = 0;
+    for (size_t j = block_size.size(); j-- > 0;) {
+        vars->global_offset.insert(vars->global_offset.begin(), offset);
+        offset += (uint64_t)1<<block_size[j];
+    }
+    vars->funnel_bits.assign(block_size.size(), 1);
+    vars->update.assign(lanes, 0);
+    vars->tmp.assign(block_size.size()*lanes, 0);
+    vars->stored.assign(block_size.size()*lanes, 0);
+    return new data_t {
+        .problem = problem,
+        .config = nullptr,
+        .segment = segment,
+        .vars = vars,
+        .metrics = metrics,
+        .transport = nullptr,
+    };
+}
+
+void lone_segment_clear(data_t* data) {
+    vars_t* vars = data->vars;
+    if (vars->precompute != nullptr) {
+        precompute_stop(vars->precompute);
+    }
+    for (std::vector<fmpz>* list : {&vars->update, &vars->tmp, &vars->stored}) {
+        for (fmpz& x : *list) {
+            fmpz_clear(&x);
+        }
+    }
+    free(vars->basecase_table);
+    free(data->metrics);
+    delete vars;
+    delete data->segment;
+    delete data->problem;
+    delete data;
+}
+
 void setup_vars(data_t* data) {
     segment_t* seg = data->segment;
     int rank = seg->world_rank;
@@ -81,18 +167,23 @@ void setup_vars(data_t* data) {
 
     vars_t* vars = data->vars;
     *vars = {
-        .update = 0,
+        .update = {},
         .p3 = {},
         .tmp = {},
         .stored = {},
+        .lanes = 1 + data->problem->batch.size(),
         .basecase_table = (basecase_table_t*) malloc(((uint64_t)1<<table_bits) * sizeof(basecase_table_t)),
         .p3base = 0,
         .table_bits = 0,
 
         .block_size = {},
         .global_offset = {},
+        .funnel_bits = {},
+        .precompute = nullptr,
+        .dormant = false,
+        .left_dormant = false,
     };
-    fmpz_init(&vars->update);
+    vars->update.assign(vars->lanes, 0);
     init_table(vars, table_bits);
 
     std::vector<std::vector<uint64_t>> sizes = data->config->block_sizes_used;
@@ -112,53 +203,77 @@ void setup_vars(data_t* data) {
         offset += (uint64_t)1<<list[j];
     }
 
-    uint64_t max_size = vars->block_size[0];
-    fmpz_t r; fmpz_init_set_ui(r, 3);
-    // TODO: yes, inclusive
-    for (uint64_t i = 0; i <= max_size; i++) {
-        // 3^(2^0) = 3^1 = 3 is the first element of p3
-        fmpz_t next; fmpz_init_set(next, r);
-        vars->p3.push_back(*next);
-        // skip the last squaring
-        if (i < max_size) {
-            fmpz_mul(r, r, r);
+    const std::vector<uint64_t> arity = data->config->funnel_arity;
+    for (size_t j = 0; j < vars->block_size.size(); j++) {
+        // nothing funnels down to the top block, call it binary
+        uint64_t k = 2;
+        if (j > 0 && arity.size() > 0) {
+            k = arity[std::min(j-1, arity.size()-1)];
         }
+        vars->funnel_bits.push_back(__builtin_ctzll(k));
     }
-    fmpz_clear(r);
 
-    const int s = vars->block_size.size();
-    for (int i = 0; i < s; i++) {
-        fmpz a; fmpz_init(&a);
-        vars->tmp.push_back(a);
-        fmpz b; fmpz_init(&b);
-        vars->stored.push_back(b);
-    }
+    const uint64_t s = vars->block_size.size();
+    vars->tmp.assign(s*vars->lanes, 0);
+    vars->stored.assign(s*vars->lanes, 0);
 
-    if (seg->is_base_segment) {
-        fmpz_set_ui(&vars->stored[vars->stored.size()-1], data->problem->initial);
+    // the bottom block holds the starting values
+    fmpz* bottom = &vars->stored[(s-1)*vars->lanes];
+    for (uint64_t j = 0; j < vars->lanes; j++) {
+        if (seg->is_base_segment) {
+            fmpz_set_ui(&bottom[j], j == 0 ? data->problem->initial : data->problem->batch[j-1]);
+        }
+        flint_printf("rank %d lane %wu init to %{fmpz}\n", data->segment->world_rank, j, &bottom[j]);
     }
-    fmpz stored = vars->stored[vars->stored.size()-1];
-    flint_printf("rank %d init to %{fmpz}\n", data->segment->world_rank, &stored);
 }
 
-data_t* segment_init(problem_t* problem, config_t* config, segment_t* segment) {
-    metrics_t* metrics = (metrics_t*) calloc (1, sizeof(metrics_t));
-    data_t* data = (data_t*) calloc (1, sizeof(data_t));
-    vars_t* vars = (vars_t*) calloc (1, sizeof(vars_t));
-    init_metrics(metrics, segment->world_size < 3 ? true : segment->world_rank > 2);
-    timer_start(metrics, active_time);
-    timer_start(metrics, initializing);
-    *data = {
-        .problem = problem,
-        .config = config,
-        .segment = segment,
-        .vars = vars,
-        .metrics = metrics,
-    };
-    constrain_config(data);
-    setup_vars(data);
-    flint_set_num_threads(data->segment->world_rank > -1 ? 4 : 1);
-    timer_stop(metrics, initializing);
-    return data;
+// The segments share the rank's powers of 3, filled up to what the top
+// one needs, since block sizes only grow along the chain.
+std::vector<data_t*> segment_init(problem_t* problem, config_t* config, segment_t* segments, int count) {
+    std::vector<data_t*> group = {};
+    for (int s = 0; s < count; s++) {
+        metrics_t* metrics = (metrics_t*) calloc (1, sizeof(metrics_t));
+        data_t* data = (data_t*) calloc (1, sizeof(data_t));
+        vars_t* vars = (vars_t*) calloc (1, sizeof(vars_t));
+        segment_t* segment = &segments[s];
+        init_metrics(metrics, segment->world_size < 3 ? true : segment->world_rank > 2);
+        if (config->hardware_counters) {
+            hardware_open(metrics);
+        }
+        if (config->profile_funnel) {
+            profile_init(metrics);
+        }
+        *data = {
+            .problem = problem,
+            .config = config,
+            .segment = segment,
+            .vars = vars,
+            .metrics = metrics,
+            .transport = nullptr,
+        };
+        group.push_back(data);
+    }
+    // every rank's trace is relative to this moment, so line them up
+    MPI_Barrier(MPI_COMM_WORLD);
+    for (data_t* data : group) {
+        timer_start(data->metrics, active_time);
+        timer_start(data->metrics, initializing);
+    }
+    // the config is shared, so it's only unrolled once
+    constrain_config(group[0]);
+    for (data_t* data : group) {
+        order_chain(data);
+        setup_vars(data);
+    }
+    data_t* top = group[count-1];
+    precompute_init(top);
+    for (data_t* data : group) {
+        data->vars->precompute = top->vars->precompute;
+    }
+    transport_init(group);
+    flint_set_num_threads(group[0]->segment->world_rank > -1 ? 4 : 1);
+    for (data_t* data : group) {
+        timer_stop(data->metrics, initializing);
+    }
+    return group;
 }
-
@@ -1,10 +1,32 @@
 
 #include "parse.h"
 #include "latencies.h"
+#include "json.h"
+#include "topology.h"
+#include "allocator.h"
+#include "kernel.h"
+#include "checkpoint.h"
+#include "analyze.h"
+#include "precompute.h"
+#include "helpers.h"
+#include "fibers.h"
+#include "blocks.h"
 
 int main() {
     test_parse_config();
     test_parse_args();
+    test_parse_latencies_args();
+    test_parse_json();
+    test_chain_order();
+    test_allocator();
+    test_mul_split();
+    test_blocks();
+    test_add_bit_range();
+    test_critical_path();
+    test_precompute();
+    test_funnel_arity();
+    test_karatsuba_pieces();
+    test_fibers();
     test_get_opponent();
     return 0;
 }
@@ -0,0 +1,203 @@
+#include <mpi.h>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "segment.h"
+#include "topology.h"
+#include "json.h"
+#include "friendly_assert.h"
+
+// The chain only ever talks to its direct neighbors, so all that
+// matters is which ranks end up next to each other. Links higher up
+// carry the largest messages, so the chain is built greedily from the
+// top down: the top gets the best link available, and every following
+// position takes the cheapest remaining partner of the one above it.
+
+// Unmeasured links cost more than any measured one.
+double link_cost(const std::vector<double>& costs, int n, int a, int b) {
+    const double ab = costs[a*n + b];
+    const double ba = costs[b*n + a];
+    if (std::isnan(ab) && std::isnan(ba)) {
+        return std::numeric_limits<double>::infinity();
+    }
+    if (std::isnan(ab)) { return ba; }
+    if (std::isnan(ba)) { return ab; }
+    return ab > ba ? ab : ba;
+}
+
+size_t nearest_size(const std::vector<uint64_t>& sizes, uint64_t size) {
+    size_t best = 0;
+    for (size_t s = 1; s < sizes.size(); s++) {
+        const uint64_t d = sizes[s] > size ? sizes[s] - size : size - sizes[s];
+        const uint64_t best_d = sizes[best] > size ? sizes[best] - size : size - sizes[best];
+        if (d < best_d) { best = s; }
+    }
+    return best;
+}
+
+// Cheapest unplaced rank. Ties go to the rank closest to the
+// position, so that uniform costs keep the usual order.
+int pick(const std::vector<double>& cost, const std::vector<bool>& placed, int position) {
+    int best = -1;
+    for (int b = 0; b < static_cast<int>(cost.size()); b++) {
+        if (placed[b]) { continue; }
+        if (best < 0 || cost[b] < cost[best] || (cost[b] == cost[best] && std::abs(b - position) < std::abs(best - position))) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+// costs[size][a*n + b] is the cost of a message of 2^sizes[size] bits
+// from a to b. link_sizes[k] is the log size of the carries between
+// positions k and k+1. Returns the rank at every position.
+std::vector<int> chain_order(const std::vector<std::vector<double>>& costs, const std::vector<uint64_t>& sizes, const std::vector<uint64_t>& link_sizes, int n) {
+    std::vector<int> order(n, -1);
+    std::vector<bool> placed(n, false);
+    if (n == 1) {
+        order[0] = 0;
+        return order;
+    }
+    // a = top candidate, scored by its best link
+    const std::vector<double>& top = costs[nearest_size(sizes, link_sizes[n-2])];
+    std::vector<double> reach(n, std::numeric_limits<double>::infinity());
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            if (a != b && link_cost(top, n, a, b) < reach[a]) {
+                reach[a] = link_cost(top, n, a, b);
+            }
+        }
+    }
+    order[n-1] = pick(reach, placed, n-1);
+    placed[order[n-1]] = true;
+    for (int k = n-2; k >= 0; k--) {
+        const std::vector<double>& c = costs[nearest_size(sizes, link_sizes[k])];
+        std::vector<double> link(n);
+        for (int b = 0; b < n; b++) {
+            link[b] = link_cost(c, n, order[k+1], b);
+        }
+        order[k] = pick(link, placed, k);
+        placed[order[k]] = true;
+    }
+    return order;
+}
+
+void test_chain_order() {
+    // two hosts {0, 2} and {1, 3}
+    const std::vector<double> hosts = {
+        0, 1, 0, 1,
+        1, 0, 1, 0,
+        0, 1, 0, 1,
+        1, 0, 1, 0,
+    };
+    std::vector<int> order = chain_order({hosts}, {0}, {8, 8, 8}, 4);
+    assert(std::vector<int>({2, 0, 1, 3}) == order);
+
+    // rank 3 is slow to reach at large sizes, but fine for small ones
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const std::vector<double> small = {
+        0, 1, 1, 1,
+        1, 0, 1, 1,
+        1, 1, 0, 1,
+        1, 1, 1, 0,
+    };
+    const std::vector<double> large = {
+        0,  2,  2,  nan,
+        2,  0,  1,  9,
+        2,  1,  0,  9,
+        9,  9,  9,  0,
+    };
+    order = chain_order({small, large}, {10, 20}, {10, 20, 22}, 4);
+    assert(std::vector<int>({3, 0, 1, 2}) == order);
+
+    order = chain_order({small}, {0}, {8, 8, 8}, 4);
+    assert(std::vector<int>({0, 1, 2, 3}) == order);
+
+    assert(std::vector<int>({0}) == chain_order({{0}}, {0}, {}, 1));
+}
+
+// Same host is free, anything else costs one hop.
+std::vector<double> host_costs(int rank, int n) {
+    char name[MPI_MAX_PROCESSOR_NAME] = {};
+    int length;
+    MPI_Get_processor_name(name, &length);
+    std::vector<char> names(rank == 0 ? n*MPI_MAX_PROCESSOR_NAME : 0);
+    MPI_Gather(name, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, names.data(), MPI_MAX_PROCESSOR_NAME, MPI_CHAR, 0, MPI_COMM_WORLD);
+    std::vector<double> costs = {};
+    if (rank != 0) { return costs; }
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            const bool same = strncmp(&names[a*MPI_MAX_PROCESSOR_NAME], &names[b*MPI_MAX_PROCESSOR_NAME], MPI_MAX_PROCESSOR_NAME) == 0;
+            costs.push_back(same ? 0 : 1);
+        }
+    }
+    return costs;
+}
+
+// Reads the "means" of a latencies run. Its ranks have to be laid out
+// the same way as this run's, i.e. same hosts and same mpirun mapping.
+void read_latencies(const char* filename, int n, std::vector<std::vector<double>>* costs, std::vector<uint64_t>* sizes) {
+    json_t j;
+    friendly_assert(read_json_file(filename, &j), "Could not read the --topology latency file.");
+    const json_t* ranks = json_get(&j, "ranks");
+    const json_t* json_sizes = json_get(&j, "sizes");
+    const json_t* means = json_get(&j, "means");
+    friendly_assert(ranks != nullptr && json_sizes != nullptr && means != nullptr, "The --topology file is not output of the latencies tool.");
+    friendly_assert(static_cast<int>(ranks->number) == n, "The --topology file was measured with a different number of ranks.");
+    for (size_t s = 0; s < json_sizes->items.size(); s++) {
+        sizes->push_back(static_cast<uint64_t>(json_sizes->items[s].number));
+        std::vector<double> matrix = {};
+        for (int a = 0; a < n; a++) {
+            for (int b = 0; b < n; b++) {
+                const json_t* x = &means->items[s].items[a].items[b];
+                matrix.push_back(x->type == json_number ? x->number : std::numeric_limits<double>::quiet_NaN());
+            }
+        }
+        costs->push_back(matrix);
+    }
+}
+
+void order_chain(data_t* data) {
+    const std::string topology = data->config->topology;
+    if (topology.empty()) {
+        return;
+    }
+    segment_t* segment = data->segment;
+    const int n = segment->world_size;
+    const int rank = segment->world_rank;
+    std::vector<std::vector<double>> costs = {};
+    std::vector<uint64_t> sizes = {};
+    if (topology == "host") {
+        costs.push_back(host_costs(rank, n));
+        sizes.push_back(0);
+    } else if (rank == 0) {
+        read_latencies(topology.c_str(), n, &costs, &sizes);
+    }
+    std::vector<int> order(n);
+    if (rank == 0) {
+        std::vector<uint64_t> link_sizes = {};
+        for (int k = 0; k+1 < n; k++) {
+            link_sizes.push_back(data->config->block_sizes_used[k].back());
+        }
+        order = chain_order(costs, sizes, link_sizes, n);
+        std::cout << "Chain order by rank:";
+        for (int k = 0; k < n; k++) {
+            std::cout << " " << order[k];
+        }
+        std::cout << std::endl;
+    }
+    MPI_Bcast(order.data(), n, MPI_INT, 0, MPI_COMM_WORLD);
+    for (int k = 0; k < n; k++) {
+        if (order[k] == rank) {
+            segment->world_rank = k;
+        }
+    }
+}